@@ -30,7 +30,8 @@ cli::CLIParser::CLIParser() {
             ("s_mag", po::value<int>(), "spatial filter magnitude")
             ("to", po::value<int>(), "move to a position")
             ("by", po::value<int>(), "move by degrees")
-            ("home", "move to 0 position");
+            ("home", "move to 0 position")
+            ("background", "with --calibrate, capture the empty turntable as the background for scans");
 }
 
 po::variables_map cli::CLIParser::get_variables_map(int argc, char *argv[]) {
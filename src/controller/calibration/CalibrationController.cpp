@@ -1,10 +1,11 @@
 #include "CalibrationController.h"
 #include "CalibrationModel.h"
-#include "Constants.h"
 #include "Point.h"
 #include "SR305.h"
 #include "Arduino.h"
 #include "Visualizer.h"
+#include "IFileHandler.h"
+#include "Logger.h"
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <memory>
@@ -16,28 +17,31 @@ controller::CalibrationController::CalibrationController(std::shared_ptr<camera:
         camera(std::move(camera)), arduino(std::move(arduino)), model(std::move(model)) {}
 
 void controller::CalibrationController::run() {
+    if (background_only) {
+        capture_background();
+        return;
+    }
     scan();
 
-    model->calculate_center_point();
+    model->finish_incremental_calibration();
     model->refine_center_point();
     model->update_calibration_json();
 //    viewer->ptVis(cloud_vector[0], pcl::PointXYZ(center.x, center.y, center.z));
 }
 
 void controller::CalibrationController::scan() {
-    using namespace constants;
-
     const camera::intrinsics intrin = camera->get_intrinsics();
+    model->start_incremental_calibration();
     for (int i = 0; i < num_rot; i++) {
         std::string cloud_name = std::to_string(i * deg) + ".pcd";
         camera->scan();
         std::vector<uint16_t> depth_frame = camera->get_depth_frame();
         std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> cloud = camera->create_point_cloud(depth_frame, intrin);
 
-        model->crop_cloud(cloud, cal_min_x, cal_max_x, cal_min_y, cal_max_y, cal_min_z, cal_max_z);
-        model->bilateral_filter(cloud, 10, .001);
-        model->voxel_grid_filter(cloud, .001);
+        model->filter_cloud(cloud, cloud_name);
         model->add_cloud(cloud, cloud_name);
+        // planes are fitted in the background while the turntable moves
+        model->fit_view_async(cloud_name);
         model->save_cloud(cloud_name);
 
         arduino->rotate_by(deg);
@@ -46,6 +50,24 @@ void controller::CalibrationController::scan() {
 
 }
 
+void controller::CalibrationController::capture_background() {
+    const camera::intrinsics intrin = camera->get_intrinsics();
+    nlohmann::json config = file::IFileHandler::get_swag_scanner_config_json();
+    int num_frames = config.value("background_frames", 30);
+    LOG_INFO("capturing {} background frames, the turntable must be empty", num_frames);
+    std::vector<std::vector<uint16_t>> frames;
+    frames.reserve(num_frames);
+    for (int i = 0; i < num_frames; i++) {
+        camera->scan();
+        frames.push_back(camera->get_depth_frame());
+    }
+    model->save_background(frames, intrin);
+}
+
+void controller::CalibrationController::set_background_only(bool background_only) {
+    this->background_only = background_only;
+}
+
 void controller::CalibrationController::set_deg(int deg) {
     this->deg = deg;
 }
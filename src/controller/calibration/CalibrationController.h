@@ -57,6 +57,17 @@ namespace controller {
 
         void set_num_rot(int rot);
 
+        /**
+         * Make run() capture the background of the empty turntable for the calibration instead of calibrating.
+         */
+        void set_background_only(bool background_only);
+
+        /**
+         * Capture "background_frames" depth frames of the empty rig and cache their median with the calibration.
+         * Scans that use the calibration then keep only pixels in front of it.
+         */
+        void capture_background();
+
 
     protected:
         std::shared_ptr<camera::ICamera> camera;
@@ -64,11 +75,13 @@ namespace controller {
         std::shared_ptr<model::CalibrationModel> model;
         int deg = 15;
         int num_rot = 8;
+        bool background_only = false;
         std::vector<std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>> clouds;
 
 
         /**
-         * Scan the calibration clouds and save them into current folder.
+         * Scan the calibration clouds and save them into current folder. The planes of each view are fitted
+         * on a background thread while the turntable rotates to the next one.
          */
         void scan();
 
@@ -27,7 +27,7 @@ void controller::CalibrationControllerGUI::run() {
     logger::info("[CALIBRATION SCANNING COMPLETE]");
     emit update_console("Scan complete");
     emit update_console("Calculating center point...");
-    model->calculate_center_point();
+    model->finish_incremental_calibration();
     emit update_console("Center point calculation complete");
     emit update_console("Refining center point calculation...");
     model->refine_center_point();
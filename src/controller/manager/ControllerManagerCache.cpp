@@ -147,6 +147,9 @@ controller::ControllerManagerCache::get_calibration_controller(const boost::prog
     if (vm.count("rot")) {
         controller->set_num_rot(vm["rot"].as<int>());
     }
+    if (vm.count("background")) {
+        controller->set_background_only(true);
+    }
     calibration_controller = controller;
     return controller;
 }
@@ -31,16 +31,22 @@ void controller::ScanController::set_num_rot(int num_rot) {
 
 void controller::ScanController::scan() {
     model->update_info_json(deg, num_rot);
+    model->start_online_registration(deg);
     camera->scan();
     const camera::intrinsics intrin = camera->get_intrinsics();
+    model->load_background(intrin);
     logger::info("started scanning...");
     for (int i = 0; i < num_rot; i++) {
         std::string name = std::to_string(i * deg) + ".pcd";
         camera->scan();
         std::vector<uint16_t> depth_frame_raw = camera->get_depth_frame();
+        model->subtract_background(depth_frame_raw);
         std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> cloud_raw = camera->create_point_cloud(depth_frame_raw, intrin);
         model->add_cloud(cloud_raw, name);
         model->save_cloud(name, CloudType::Type::RAW);
+        // registers while the turntable moves to the next angle
+        model->register_view_async(name);
         arduino->rotate_by(deg);
     }
+    model->finish_online_registration();
 }
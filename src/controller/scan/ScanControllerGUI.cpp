@@ -18,16 +18,22 @@ controller::ScanControllerGUI::ScanControllerGUI(std::shared_ptr<camera::ICamera
 
 void controller::ScanControllerGUI::run() {
     model->update_info_json(deg, num_rot);
+    model->start_online_registration(deg);
 
     const camera::intrinsics intrin = camera->get_intrinsics();
+    if (model->load_background(intrin)) {
+        emit update_console("Subtracting the calibration background");
+    }
     emit update_console("Started scanning...");
 
     if (num_rot == 0) {
         camera->scan();
         std::vector<uint16_t> depth_frame_raw = camera->get_depth_frame();
+        model->subtract_background(depth_frame_raw);
         std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> cloud_raw = camera->create_point_cloud(depth_frame_raw, intrin);
         model->add_cloud(cloud_raw, "0.pcd");
         model->save_cloud("0.pcd", CloudType::Type::RAW);
+        model->register_view_async("0.pcd");
     }
 
     logger::info("[STARTED SCANNING]");
@@ -38,13 +44,20 @@ void controller::ScanControllerGUI::run() {
         std::this_thread::sleep_for(timespan);
         camera->scan();
         std::vector<uint16_t> depth_frame_raw = camera->get_depth_frame();
+        model->subtract_background(depth_frame_raw);
         std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> cloud_raw = camera->create_point_cloud(depth_frame_raw, intrin);
         model->add_cloud(cloud_raw, name);
         model->save_cloud(name, CloudType::Type::RAW);
+        // registers while the turntable moves to the next angle
+        model->register_view_async(name);
         arduino->rotate_by(deg);
         // add a delay to avoid ghosting
         std::this_thread::sleep_for(timespan);
     }
+    std::vector<std::size_t> bad_views = model->finish_online_registration();
+    if (!bad_views.empty()) {
+        emit update_console(std::to_string(bad_views.size()) + " views failed online registration, see the log");
+    }
     logger::info("[SCANNING COMPLETE]");
     emit update_console("Scan complete!");
 }
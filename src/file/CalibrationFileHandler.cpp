@@ -56,7 +56,7 @@ void file::CalibrationFileHandler::save_cloud(const std::shared_ptr<pcl::PointCl
                                               const CloudType::Type &cloud_type) {
     fs::path out_path = scan_folder_path / cloud_name;
     pcl::io::savePCDFileASCII(out_path.string(), *cloud);
-    logger::info("saved cloud: " + cloud_name + " of type: " + CloudType::String(cloud_type));
+    LOG_INFO("saved cloud: {} of type: {}", cloud_name, CloudType::String(cloud_type));
 }
 
 std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> file::CalibrationFileHandler::load_cloud(const std::string &cloud_name,
@@ -87,7 +87,7 @@ std::vector<std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>> file::CalibrationFi
     std::sort(cloud_paths.begin(), cloud_paths.end(), path_sort);
 
     // finally we load the clouds into the cloud_vector
-    logger::info("loading clouds from: " + load_path.string());
+    LOG_INFO("loading clouds from: {}", load_path.string());
     for (auto &p : cloud_paths) {
         auto cloud = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
         if (pcl::io::loadPCDFile<pcl::PointXYZ>(p.string(), *cloud) == -1) {
@@ -112,6 +112,26 @@ void file::CalibrationFileHandler::update_calibration_json(const equations::Norm
     update_calibration_json(dir, equations::Point(pt.x, pt.y, pt.z));
 }
 
+void file::CalibrationFileHandler::update_pipeline_json(const json &pipeline_json) {
+    std::ofstream updated_file(scan_folder_path / "pipeline.json");
+    updated_file << std::setw(4) << pipeline_json << std::endl; // write to file
+}
+
+void file::CalibrationFileHandler::save_background(const std::vector<uint16_t> &background,
+                                                  int width,
+                                                  int height,
+                                                  int frames) {
+    save_depth_image(scan_folder_path / "background.depth", background);
+    json calibration_json = get_calibration_json();
+    calibration_json["background"] = {{"file",   "background.depth"},
+                                      {"width",  width},
+                                      {"height", height},
+                                      {"frames", frames}};
+    std::ofstream updated_file(scan_folder_path / fs::path(scan_name + ".json"));
+    updated_file << std::setw(4) << calibration_json << std::endl; // write to file
+    LOG_INFO("saved background of {} frames to {}", frames, scan_name);
+}
+
 void file::CalibrationFileHandler::create_calibration_json() {
     std::ofstream calibration(scan_folder_path / fs::path(scan_name + ".json")); // create json file
     json calibration_json = {
@@ -66,6 +66,22 @@ namespace file {
 
         void update_calibration_json(const equations::Normal &dir, const pcl::PointXYZ &pt);
 
+        /**
+         * Write the filter pipeline description and its stage stats to pipeline.json in the calibration folder.
+         * @param pipeline_json json with the pipeline and stats.
+         */
+        void update_pipeline_json(const nlohmann::json &pipeline_json);
+
+        /**
+         * Cache the fused depth image of the empty rig as background.depth next to the calibration .json and
+         * record its size there, so scans using this calibration can subtract it.
+         * @param background fused depth image.
+         * @param width image width in pixels.
+         * @param height image height in pixels.
+         * @param frames number of frames that were fused.
+         */
+        void save_background(const std::vector<uint16_t> &background, int width, int height, int frames);
+
     private:
 
         /**
@@ -1,4 +1,5 @@
 #include "IFileHandler.h"
+#include "FilterPipeline.h"
 #include "Logger.h"
 #include <CoreServices/CoreServices.h>
 #include <fstream>
@@ -49,7 +50,30 @@ bool file::IFileHandler::check_program_folder() {
                 {"decimation_magnitude",     2},
                 {"spatial_filter_magnitude", 1},
                 {"spatial_smooth_alpha",     .45},
-                {"spatial_smooth_delta",     5}
+                {"spatial_smooth_delta",     5},
+                {"log_overflow_policy",      "block"},
+                {"log_flush_interval",       3},
+                {"registration_method",      "turntable"},
+                {"registration_icp",         "point_to_point"},
+                {"registration_pyramid",     json::array()},
+                {"registration_full_iterations", 5},
+                {"online_registration",      false},
+                {"online_max_correspondence_distance", .005},
+                {"online_max_rmse",          .003},
+                {"online_min_overlap",       .3},
+                {"online_max_deviation",     3},
+                {"merge_method",             "concatenate"},
+                {"voxel_merge_leaf_size",    .001},
+                {"voxel_merge_min_views",    2},
+                {"tsdf_voxel_size",          .001},
+                {"tsdf_truncation",          .004},
+                {"tsdf_min_weight",          2},
+                {"background_frames",        30},
+                {"background_subtraction",   true},
+                {"background_margin",        .005},
+                {"scan_volume",                 model::FilterPipeline::default_scan_volume()},
+                {"scan_filter_pipeline",        model::FilterPipeline::default_scan_pipeline()},
+                {"calibration_filter_pipeline", model::FilterPipeline::default_calibration_pipeline()}
         };
         config << std::setw(4) << config_json << std::endl; // write to file
         return false;
@@ -109,6 +133,25 @@ fs::path file::IFileHandler::find_latest_calibration() {
 }
 
 
+void file::IFileHandler::save_depth_image(const fs::path &path, const std::vector<uint16_t> &depth) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(depth.data()), std::streamsize(depth.size() * sizeof(uint16_t)));
+    if (!out) {
+        throw std::runtime_error("could not write depth image " + path.string());
+    }
+}
+
+std::vector<uint16_t> file::IFileHandler::load_depth_image(const fs::path &path) {
+    std::vector<uint16_t> depth;
+    if (!fs::exists(path)) {
+        return depth;
+    }
+    depth.resize(fs::file_size(path) / sizeof(uint16_t));
+    std::ifstream in(path, std::ios::binary);
+    in.read(reinterpret_cast<char *>(depth.data()), std::streamsize(depth.size() * sizeof(uint16_t)));
+    return depth;
+}
+
 bool file::IFileHandler::path_sort(const fs::path &path1, const fs::path &path2) {
     std::string string1 = path1.string();
     std::string string2 = path2.string();
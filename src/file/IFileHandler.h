@@ -116,6 +116,23 @@ namespace file {
          */
         static std::vector<std::string> get_all_calibrations();
 
+        /**
+         * Write a depth image as raw 16 bit values in native byte order.
+         *
+         * @param path file to write.
+         * @param depth depth image.
+         * @throws runtime_error if the file can't be written.
+         */
+        static void save_depth_image(const std::filesystem::path &path, const std::vector<uint16_t> &depth);
+
+        /**
+         * Read a depth image written by save_depth_image.
+         *
+         * @param path file to read.
+         * @return depth image, empty if the file doesn't exist.
+         */
+        static std::vector<uint16_t> load_depth_image(const std::filesystem::path &path);
+
 
         /**
          * Loads all clouds in the current scan folder into a vector given the calibration type.
@@ -123,6 +123,16 @@ void file::ScanFileHandler::update_info_json(const std::string &date,
     updated_file << std::setw(4) << info_json << std::endl; // write to file
 }
 
+void file::ScanFileHandler::update_pipeline_json(const json &pipeline_json) {
+    std::ofstream updated_file(scan_folder_path / "info/pipeline.json");
+    updated_file << std::setw(4) << pipeline_json << std::endl; // write to file
+}
+
+void file::ScanFileHandler::update_registration_json(const json &registration_json) {
+    std::ofstream updated_file(scan_folder_path / "info/registration.json");
+    updated_file << std::setw(4) << registration_json << std::endl; // write to file
+}
+
 json file::ScanFileHandler::get_calibration_json() {
     json info_json = get_info_json();
     std::string calibration_path = info_json["calibration"];
@@ -132,6 +142,27 @@ json file::ScanFileHandler::get_calibration_json() {
     return calibration_json;
 }
 
+std::vector<uint16_t> file::ScanFileHandler::load_background(int width, int height) {
+    json calibration_json = get_calibration_json();
+    if (!calibration_json.contains("background")) {
+        return {};
+    }
+    const json &background_json = calibration_json["background"];
+    if (background_json["width"] != width || background_json["height"] != height) {
+        LOG_ERROR("background was captured at {}x{}, camera is at {}x{}, capture it again",
+                  background_json["width"].get<int>(), background_json["height"].get<int>(), width, height);
+        return {};
+    }
+    std::string calibration_path = get_info_json()["calibration"];
+    std::vector<uint16_t> background = load_depth_image(
+            fs::path(calibration_path).parent_path() / background_json["file"].get<std::string>());
+    if (background.size() != std::size_t(width) * height) {
+        LOG_ERROR("background file of the calibration is missing or truncated");
+        return {};
+    }
+    return background;
+}
+
 fs::path file::ScanFileHandler::find_latest_scan() {
     std::ifstream info(swag_scanner_path / "settings/info.json");
     json info_json;
@@ -69,6 +69,14 @@ namespace file {
          */
         nlohmann::json get_calibration_json();
 
+        /**
+         * Load the background depth image cached with this scan's calibration.
+         * @param width expected image width in pixels.
+         * @param height expected image height in pixels.
+         * @return background, empty if the calibration has none or it was captured at another resolution.
+         */
+        std::vector<uint16_t> load_background(int width, int height);
+
         /**
          * Get the info.json file.
          * @return json file.
@@ -86,6 +94,18 @@ namespace file {
                               int num_rot,
                               const std::string &cal = "None");
 
+        /**
+         * Write the filter pipeline description and its stage stats to info/pipeline.json.
+         * @param pipeline_json json with the pipeline and stats.
+         */
+        void update_pipeline_json(const nlohmann::json &pipeline_json);
+
+        /**
+         * Write registration edges and solver stats to info/registration.json.
+         * @param registration_json json with the registration results.
+         */
+        void update_registration_json(const nlohmann::json &registration_json);
+
     private:
 
 
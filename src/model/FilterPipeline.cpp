@@ -0,0 +1,259 @@
+#include "FilterPipeline.h"
+#include "IModel.h"
+#include "Constants.h"
+#include "Algorithms.h"
+#include "MortonOrder.h"
+#include "Transforms.h"
+#include "Logger.h"
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <fstream>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+using json = nlohmann::json;
+using NormalsPtr = std::shared_ptr<pcl::PointCloud<pcl::Normal>>;
+
+namespace {
+    std::size_t count_finite(const pcl::PointCloud<pcl::PointXYZ> &cloud) {
+        std::size_t count = 0;
+        for (const auto &p : cloud.points) {
+            count += std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+        }
+        return count;
+    }
+
+    std::size_t current_rss_bytes() {
+#ifdef __APPLE__
+        mach_task_basic_info_data_t info{};
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) !=
+            KERN_SUCCESS) {
+            return 0;
+        }
+        return info.resident_size;
+#else
+        // second field of statm is the resident set in pages
+        std::ifstream statm("/proc/self/statm");
+        std::size_t size = 0, resident = 0;
+        statm >> size >> resident;
+        return resident * std::size_t(sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+    std::size_t peak_rss_bytes() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss;
+#else
+        return usage.ru_maxrss * 1024;
+#endif
+    }
+}
+
+model::FilterPipeline::FilterPipeline(const json &stages, IModel &model) : stages_json(stages) {
+    if (!stages.is_array()) {
+        throw std::invalid_argument("filter pipeline must be a json array of stages");
+    }
+    for (const auto &stage : stages) {
+        this->stages.push_back(build_stage(stage, model));
+    }
+}
+
+std::vector<model::StageStats>
+model::FilterPipeline::run(std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud) const {
+    std::shared_ptr<pcl::PointCloud<pcl::Normal>> normals;
+    return run(cloud, normals);
+}
+
+std::vector<model::StageStats>
+model::FilterPipeline::run(std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                           std::shared_ptr<pcl::PointCloud<pcl::Normal>> &normals) const {
+    normals = nullptr;
+    std::vector<StageStats> stats;
+    stats.reserve(stages.size());
+    for (const auto &stage : stages) {
+        StageStats s;
+        s.stage = stage.name;
+        s.points_in = count_finite(*cloud);
+        std::size_t rss_before = current_rss_bytes();
+        auto start = std::chrono::steady_clock::now();
+        stage.apply(cloud, normals);
+        s.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (normals != nullptr && normals->points.size() != cloud->points.size()) {
+            LOG_DEBUG("filter stage {} changed the number of points, dropping normals", stage.name);
+            normals = nullptr;
+        }
+        s.points_out = count_finite(*cloud);
+        s.rss_delta_bytes = (long long) current_rss_bytes() - (long long) rss_before;
+        s.process_peak_rss_bytes = peak_rss_bytes();
+        stats.push_back(s);
+    }
+    return stats;
+}
+
+const json &model::FilterPipeline::get_json() const {
+    return stages_json;
+}
+
+json model::FilterPipeline::from_config(const json &config, const std::string &key) {
+    if (config.contains(key)) {
+        return config[key];
+    }
+    if (key == "calibration_filter_pipeline") {
+        return default_calibration_pipeline();
+    }
+    return default_scan_pipeline();
+}
+
+json model::FilterPipeline::default_scan_pipeline() {
+    using namespace constants;
+    return json::array({
+                               {{"type", "bilateral"}, {"sigma_s", 10}, {"sigma_r", .01}},
+                               {{"type", "organized_normals"}, {"step", 2}, {"max_edge", .01}},
+                               {{"type", "remove_nan"}},
+                               {{"type", "remove_outliers"}, {"mean_k", 50}, {"thresh_mult", 1}},
+                               {{"type", "morton_sort"}}
+                       });
+}
+
+json model::FilterPipeline::default_scan_volume() {
+    using namespace constants;
+    return {{"diameter",       BED_DIAMETER},
+            {"surface_offset", .002},
+            {"max_height",     scan_max_z}};
+}
+
+transforms::CylinderCrop model::FilterPipeline::scan_volume(const json &config) {
+    const float inf = std::numeric_limits<float>::infinity();
+    json volume = config.contains("scan_volume") ? config["scan_volume"] : default_scan_volume();
+    if (volume.is_null()) {
+        return {inf, -inf, inf};
+    }
+    json defaults = default_scan_volume();
+    return {volume.value("diameter", defaults["diameter"].get<float>()) / 2,
+            volume.value("surface_offset", defaults["surface_offset"].get<float>()),
+            volume.value("max_height", defaults["max_height"].get<float>())};
+}
+
+json model::FilterPipeline::default_calibration_pipeline() {
+    using namespace constants;
+    return json::array({
+                               {{"type", "crop"},
+                                       {"min", {cal_min_x, cal_min_y, cal_min_z}},
+                                       {"max", {cal_max_x, cal_max_y, cal_max_z}}},
+                               {{"type", "bilateral"}, {"sigma_s", 10}, {"sigma_r", .001}}
+                       });
+}
+
+json model::FilterPipeline::stats_to_json(const std::vector<StageStats> &stats) {
+    json out = json::array();
+    for (const auto &s : stats) {
+        out.push_back({{"stage",                  s.stage},
+                       {"wall_ms",                s.wall_ms},
+                       {"points_in",              s.points_in},
+                       {"points_out",             s.points_out},
+                       {"rss_delta_bytes",        s.rss_delta_bytes},
+                       {"process_peak_rss_bytes", s.process_peak_rss_bytes}});
+    }
+    return out;
+}
+
+model::FilterPipeline::Stage model::FilterPipeline::build_stage(const json &stage, IModel &model) {
+    if (!stage.contains("type")) {
+        throw std::invalid_argument("filter stage is missing a \"type\": " + stage.dump());
+    }
+    std::string type = stage["type"];
+
+    if (type == "turntable") {
+        // pipelines run on world coordinates, where the calibrated turntable is z = 0 and the axis is z
+        float diameter = stage.value("diameter", constants::BED_DIAMETER);
+        float surface_offset = stage.value("surface_offset", .002f);
+        float max_height = stage.value("max_height", std::numeric_limits<float>::infinity());
+        return {type, [diameter, surface_offset, max_height](std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                                                             NormalsPtr &) {
+            std::size_t removed = algos::remove_turntable(*cloud, Eigen::Vector3f::Zero(), Eigen::Vector3f::UnitZ(),
+                                                          diameter, surface_offset, max_height);
+            LOG_INFO("removed {} turntable and background points", removed);
+        }};
+    } else if (type == "crop") {
+        auto min = stage.at("min").get<std::vector<float>>();
+        auto max = stage.at("max").get<std::vector<float>>();
+        if (min.size() != 3 || max.size() != 3) {
+            throw std::invalid_argument("crop stage needs 3 element \"min\" and \"max\"");
+        }
+        return {type, [&model, min, max](std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud, NormalsPtr &) {
+            model.crop_cloud(cloud, min[0], max[0], min[1], max[1], min[2], max[2]);
+        }};
+    } else if (type == "bilateral") {
+        float sigma_s = stage.value("sigma_s", 5.0f);
+        float sigma_r = stage.value("sigma_r", 5e-3f);
+        return {type, [&model, sigma_s, sigma_r](std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud, NormalsPtr &) {
+            model.bilateral_filter(cloud, sigma_s, sigma_r);
+        }};
+    } else if (type == "remove_nan") {
+        return {type, [&model](std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud, NormalsPtr &normals) {
+            std::vector<int> kept;
+            model.remove_nan(cloud, kept);
+            if (normals != nullptr) {
+                auto kept_normals = std::make_shared<pcl::PointCloud<pcl::Normal>>();
+                kept_normals->points.reserve(kept.size());
+                for (int i : kept) {
+                    kept_normals->points.push_back(normals->points[i]);
+                }
+                kept_normals->width = kept_normals->points.size();
+                kept_normals->height = 1;
+                normals = kept_normals;
+            }
+        }};
+    } else if (type == "organized_normals") {
+        int step = stage.value("step", 2);
+        float max_edge = stage.value("max_edge", .01f);
+        return {type, [step, max_edge](std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud, NormalsPtr &normals) {
+            normals = std::make_shared<pcl::PointCloud<pcl::Normal>>(
+                    algos::estimate_organized_normals(*cloud, step, max_edge));
+        }};
+    } else if (type == "remove_outliers") {
+        int mean_k = stage.value("mean_k", 50);
+        float thresh_mult = stage.value("thresh_mult", 1.0f);
+        return {type, [&model, mean_k, thresh_mult](std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                                                    NormalsPtr &) {
+            model.remove_outliers(cloud, mean_k, thresh_mult);
+        }};
+    } else if (type == "voxel_grid") {
+        float leaf_size = stage.value("leaf_size", .01f);
+        std::string policy_name = stage.value("policy", std::string("centroid"));
+        algos::VoxelPolicy policy;
+        if (policy_name == "centroid") {
+            policy = algos::VoxelPolicy::CENTROID;
+        } else if (policy_name == "first_point") {
+            policy = algos::VoxelPolicy::FIRST_POINT;
+        } else {
+            throw std::invalid_argument("unknown voxel_grid policy: " + policy_name);
+        }
+        return {type, [&model, leaf_size, policy](std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                                                  NormalsPtr &) {
+            model.voxel_grid_filter(cloud, leaf_size, policy);
+        }};
+    } else if (type == "morton_sort") {
+        return {type, [](std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud, NormalsPtr &normals) {
+            std::vector<uint32_t> order = algos::morton_sort(*cloud);
+            if (normals != nullptr) {
+                auto sorted_normals = std::make_shared<pcl::PointCloud<pcl::Normal>>();
+                sorted_normals->points.resize(order.size());
+                for (std::size_t k = 0; k < order.size(); k++) {
+                    sorted_normals->points[k] = normals->points[order[k]];
+                }
+                sorted_normals->width = sorted_normals->points.size();
+                sorted_normals->height = 1;
+                normals = sorted_normals;
+            }
+        }};
+    }
+    throw std::invalid_argument("unknown filter stage type: " + type);
+}
@@ -0,0 +1,153 @@
+#ifndef SWAG_SCANNER_FILTERPIPELINE_H
+#define SWAG_SCANNER_FILTERPIPELINE_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+namespace pcl {
+    class PointXYZ;
+
+    struct Normal;
+
+    template<class pointT>
+    class PointCloud;
+}
+
+namespace transforms {
+    struct CylinderCrop;
+}
+
+namespace model {
+    class IModel;
+
+    /**
+     * What happened to a cloud in one stage of a pipeline run.
+     */
+    struct StageStats {
+        std::string stage;
+        double wall_ms = 0;
+        std::size_t points_in = 0;   /** finite points going into the stage */
+        std::size_t points_out = 0;  /** finite points coming out of the stage */
+        long long rss_delta_bytes = 0;  /** change of the resident set over the stage, views filtered in parallel
+                                            share the process so their allocations show up too */
+        std::size_t process_peak_rss_bytes = 0; /** lifetime high water mark of the process after the stage, it
+                                                    never goes down, so it only says which stage set the peak */
+    };
+
+    /**
+     * Ordered chain of filter stages described in json, e.g. in settings/config.json:
+     *
+     * "scan_filter_pipeline": [
+     *     {"type": "bilateral", "sigma_s": 10, "sigma_r": 0.01},
+     *     {"type": "organized_normals", "step": 2, "max_edge": 0.01},
+     *     {"type": "remove_nan"},
+     *     {"type": "remove_outliers", "mean_k": 50, "thresh_mult": 1},
+     *     {"type": "morton_sort"}
+     * ]
+     *
+     * The json is parsed once into a list of callables, then run() can be called on any number of clouds
+     * (concurrently too, stages don't hold state between clouds).
+     * Scans are cropped to "scan_volume" (see scan_volume()) while they are moved to world coordinates, before
+     * the pipeline runs. "turntable" does the same removal as a stage for clouds that are already in world
+     * coordinates, "crop" is a plain box on top of the scan volume.
+     * "morton_sort" puts the points in Morton order so later neighbor searches stay cache friendly.
+     * Normals made by "organized_normals" travel with the cloud through remove_nan, morton_sort and stages
+     * that keep the points in place. A stage that changes the number of points drops them.
+     */
+    class FilterPipeline {
+    public:
+
+        /**
+         * Build the chain.
+         *
+         * @param stages json array of stage objects, each with a "type" and its parameters.
+         * @param model model whose filters the stages call.
+         * @throws invalid_argument if a stage type is unknown or the json is malformed.
+         */
+        FilterPipeline(const nlohmann::json &stages, IModel &model);
+
+        /**
+         * Run every stage on the cloud in order.
+         *
+         * @param cloud cloud to filter in place.
+         * @return stats for every stage.
+         */
+        std::vector<StageStats> run(std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud) const;
+
+        /**
+         * Run every stage and keep the normals the pipeline computes.
+         *
+         * @param cloud cloud to filter in place.
+         * @param normals set to normals matching the filtered cloud point for point, or nullptr if the
+         * pipeline has no normal stage or a later stage invalidated them.
+         * @return stats for every stage.
+         */
+        std::vector<StageStats> run(std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                                    std::shared_ptr<pcl::PointCloud<pcl::Normal>> &normals) const;
+
+        /**
+         * @return the json the pipeline was built from.
+         */
+        const nlohmann::json &get_json() const;
+
+        /**
+         * Get the pipeline from config.json, falling back to the default if the key is missing.
+         *
+         * @param config config.json contents.
+         * @param key e.g. "scan_filter_pipeline".
+         * @return json array of stages.
+         */
+        static nlohmann::json from_config(const nlohmann::json &config, const std::string &key);
+
+        /**
+         * Default pipeline for processing scans. Same as the old hardcoded ProcessingModel::filter plus
+         * organized normals for point to plane registration. There is no turntable stage, the scan volume
+         * crop already removed the turntable.
+         */
+        static nlohmann::json default_scan_pipeline();
+
+        /**
+         * Default "scan_volume": the bed, from 2 mm above its surface up to scan_max_z.
+         */
+        static nlohmann::json default_scan_volume();
+
+        /**
+         * Cylinder scans are cropped to while they are transformed to world coordinates, read from
+         * "scan_volume" in config.json, e.g. {"diameter": 0.18, "surface_offset": 0.002, "max_height": 0.17}.
+         * Missing keys take the defaults. "scan_volume": null turns the crop off, e.g. to keep a "crop" stage
+         * that reaches past the bed.
+         *
+         * @param config config.json contents.
+         * @return cylinder in world coordinates.
+         */
+        static transforms::CylinderCrop scan_volume(const nlohmann::json &config);
+
+        /**
+         * Default pipeline for calibration clouds: crop and bilateral filter. There is no voxel grid, so the
+         * clouds stay organized and plane fitting can take normals from the pixel grid.
+         */
+        static nlohmann::json default_calibration_pipeline();
+
+        /**
+         * Convert stats to json so they can be written to the info/ folder.
+         */
+        static nlohmann::json stats_to_json(const std::vector<StageStats> &stats);
+
+    private:
+        struct Stage {
+            std::string name;
+            std::function<void(std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &,
+                               std::shared_ptr<pcl::PointCloud<pcl::Normal>> &)> apply;
+        };
+
+        nlohmann::json stages_json;
+        std::vector<Stage> stages;
+
+        static Stage build_stage(const nlohmann::json &stage, IModel &model);
+    };
+}
+
+#endif //SWAG_SCANNER_FILTERPIPELINE_H
@@ -2,12 +2,12 @@
 #define SWAG_SCANNER_IMODEL_H
 
 #include "CloudType.h"
+#include "Algorithms.h"
 #include "Logger.h"
 #include <memory>
 #include <vector>
 #include <map>
 #include <pcl/filters/crop_box.h>
-#include <pcl/filters/voxel_grid.h>
 #include <pcl/filters/filter.h>
 #include <pcl/filters/fast_bilateral.h>
 #include <pcl/filters/statistical_outlier_removal.h>
@@ -73,7 +73,7 @@ namespace model {
             boxFilter.setInputCloud(cloud);
             boxFilter.filter(*cloud);
             auto removed_indices = boxFilter.getRemovedIndices();
-            logger::info("applied box filter, removed " + std::to_string(removed_indices->size()) + " points");
+            LOG_INFO("applied box filter, removed {} points", removed_indices->size());
         }
 
         /**
@@ -94,28 +94,26 @@ namespace model {
             boxFilter.setInputCloud(cloud);
             boxFilter.filter(*cropped);
             auto removed_indices = boxFilter.getRemovedIndices();
-            logger::info("applied box filter, removed " + std::to_string(removed_indices->size()) + " points");
+            LOG_INFO("applied box filter, removed {} points", removed_indices->size());
             return cropped;
         }
 
         /**
-        * Downsample the given calibration using voxel grid in place.
+        * Downsample the given calibration using a sparse hashed voxel grid in place.
+        * Works with any bounding box and tiny leaves, see algos::voxel_hash_downsample.
          *
         * @param cloud calibration you want to downsample.
         * @param leafSize size of leaf.
+        * @param policy keep the voxel centroid or the first point that fell in the voxel.
         */
         inline void voxel_grid_filter(std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
-                                      float leafSize = .01) {
-            pcl::VoxelGrid<pcl::PointXYZ> grid;
+                                      float leafSize = .01,
+                                      algos::VoxelPolicy policy = algos::VoxelPolicy::CENTROID) {
             int cloud_size_before = cloud->width * cloud->height;
-            grid.setInputCloud(cloud);
-            grid.setLeafSize(leafSize, leafSize, leafSize);
-            grid.filter(*cloud);
+            *cloud = algos::voxel_hash_downsample(cloud, leafSize, policy);
             int cloud_size_after = cloud->width * cloud->height;
-            logger::info("applied voxel grid downsampling (leafSize=" + std::to_string(leafSize) + ")" +
-                         " point cloud size before: " + std::to_string(cloud_size_before) + ", after: " +
-                         std::to_string(cloud_size_after));
-
+            LOG_INFO("applied voxel grid downsampling (leafSize={}) point cloud size before: {}, after: {}",
+                     leafSize, cloud_size_before, cloud_size_after);
         }
 
         /**
@@ -135,8 +133,7 @@ namespace model {
             bilateral.setSigmaS(sigma_s);
             bilateral.setSigmaR(sigma_r);
             bilateral.applyFilter(*cloud);
-            logger::info("applied bilateral filter (sigma_s=" + std::to_string(sigma_s) +
-                         ", sigma_r=" + std::to_string(sigma_r) + ")");
+            LOG_INFO("applied bilateral filter (sigma_s={}, sigma_r={})", sigma_s, sigma_r);
         }
 
 
@@ -159,8 +156,8 @@ namespace model {
             sor.filter(*cloud);
 
             auto removed_indices = sor.getRemovedIndices();
-            logger::info("applied outlier removal (mean_k= " + std::to_string(mean_k) + ", thresh_mult=" +
-            std::to_string(thresh_mult) + ") removed " + std::to_string(removed_indices->size()) + " outliers");
+            LOG_INFO("applied outlier removal (mean_k= {}, thresh_mult={}) removed {} outliers",
+                     mean_k, thresh_mult, removed_indices->size());
         }
 
         /**
@@ -170,9 +167,21 @@ namespace model {
          * @return
          */
         inline void remove_nan(std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud) {
-            std::vector<int> indices;
-            pcl::removeNaNFromPointCloud(*cloud, *cloud, indices);
-            logger::info("applied NaN filter, removed " + std::to_string(indices.size()) + " NaN points");
+            std::vector<int> kept;
+            remove_nan(cloud, kept);
+        }
+
+        /**
+         * Remove NaN points in place and report where the remaining points came from, so data kept next to
+         * the cloud (e.g. normals) can be filtered the same way.
+         *
+         * @param cloud cloud to remove points from.
+         * @param kept filled with the old index of every point that is left.
+         */
+        inline void remove_nan(std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud, std::vector<int> &kept) {
+            std::size_t size_before = cloud->points.size();
+            pcl::removeNaNFromPointCloud(*cloud, *cloud, kept);
+            LOG_INFO("applied NaN filter, removed {} NaN points", size_before - kept.size());
         }
 
         /**
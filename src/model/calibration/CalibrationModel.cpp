@@ -6,22 +6,31 @@
 #include "Visualizer.h"
 #include "CloudType.h"
 #include "Logger.h"
+#include "Parallel.h"
+#include "RansacPlane.h"
+#include "DepthBackground.h"
+#include "CameraTypes.h"
 #include <pcl/ModelCoefficients.h>
-#include <pcl/sample_consensus/method_types.h>
-#include <pcl/sample_consensus/model_types.h>
-#include <pcl/segmentation/sac_segmentation.h>
-#include <pcl/filters/extract_indices.h>
-#include <pcl/features/normal_3d.h>
+#include <pcl/features/normal_3d_omp.h>
+#include <pcl/search/kdtree.h>
+#include <chrono>
 
 model::CalibrationModel::CalibrationModel() :
         file_handler() {}
 
+model::CalibrationModel::~CalibrationModel() {
+    for (auto &task : view_tasks) {
+        task.wait();
+    }
+}
+
 
 void model::CalibrationModel::set_calibration(const std::string &cal_name) {
     file_handler.set_calibration(cal_name);
     clouds = file_handler.load_clouds(CloudType::Type::CALIBRATION);
     ground_planes.clear();
     upright_planes.clear();
+    pipeline.reset();
 }
 
 
@@ -31,39 +40,138 @@ void model::CalibrationModel::save_cloud(const std::string &cloud_name) {
 }
 
 
+void model::CalibrationModel::filter_cloud(std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                                           const std::string &cloud_name) {
+    if (pipeline == nullptr) {
+        nlohmann::json config = file::IFileHandler::get_swag_scanner_config_json();
+        pipeline = std::make_unique<FilterPipeline>(
+                FilterPipeline::from_config(config, "calibration_filter_pipeline"), *this);
+        pipeline_stats = {{"pipeline", pipeline->get_json()},
+                          {"views",    nlohmann::json::array()}};
+    }
+    std::vector<StageStats> stats = pipeline->run(cloud);
+    pipeline_stats["views"].push_back({{"view",   cloud_name},
+                                       {"stages", FilterPipeline::stats_to_json(stats)}});
+    file_handler.update_pipeline_json(pipeline_stats);
+}
+
+void model::CalibrationModel::save_background(const std::vector<std::vector<uint16_t>> &frames,
+                                              const camera::intrinsics &intrinsics) {
+    std::vector<uint16_t> fused = algos::fuse_depth_frames(frames, int(frames.size() + 1) / 2);
+    file_handler.save_background(fused, intrinsics.width, intrinsics.height, int(frames.size()));
+}
+
 pcl::PointXYZ model::CalibrationModel::calculate_center_point() {
-    // use clouds to find ground and upright planes.
-    for (const auto &c : clouds) {
-        std::vector<equations::Plane> coeffs = get_calibration_planes_coefs(c);
-        ground_planes.emplace_back(coeffs[0]);
-        upright_planes.emplace_back(coeffs[1]);
+    // use clouds to find ground and upright planes. views are independent until the solve, so segment them
+    // on every core and collect planes and logs in view order
+    std::vector<std::vector<equations::Plane>> view_planes(clouds.size());
+    std::vector<logger::LogBuffer> view_logs(clouds.size());
+    parallel::for_each_index(clouds.size(), [&](std::size_t i) {
+        logger::LogCapture capture(view_logs[i]);
+        view_planes[i] = get_calibration_planes_coefs(clouds[i]);
+    });
+    ground_planes.clear();
+    upright_planes.clear();
+    for (std::size_t i = 0; i < clouds.size(); i++) {
+        logger::replay(view_logs[i]);
+        ground_planes.emplace_back(view_planes[i][0]);
+        upright_planes.emplace_back(view_planes[i][1]);
     }
 
     // calculate rotation axis direction and use the calculated data so far to construct matrices
     axis_of_rotation = calculate_axis_dir(ground_planes);
-    Eigen::MatrixXd A = build_A_matrix(axis_of_rotation, upright_planes);
-    Eigen::MatrixXd b = build_b_matrix(axis_of_rotation, upright_planes);
+    solver = CenterPointSolver();
+    for (const auto &upright : upright_planes) {
+        solver.add_view(upright);
+    }
+    solver.set_axis(axis_of_rotation);
 
     // solve!!
-    Eigen::MatrixXd sol_mat = A.bdcSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(b);
-    std::vector<double> sol_vec(sol_mat.data(), sol_mat.data() + sol_mat.rows() * sol_mat.cols());
-    center_point = pcl::PointXYZ(sol_vec[0], sol_vec[1], sol_vec[2]);
-    logger::info("calculated center point: (" +
-                 std::to_string(center_point.x) + ", " +
-                 std::to_string(center_point.y) + ", " +
-                 std::to_string(center_point.z) + ")");
+    return solve_center_point();
+}
+
+void model::CalibrationModel::start_incremental_calibration() {
+    for (auto &task : view_tasks) {
+        task.wait();
+    }
+    view_tasks.clear();
+}
+
+void model::CalibrationModel::fit_view_async(const std::string &cloud_name) {
+    std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> cloud = clouds[clouds_map[cloud_name]];
+    // the fit only reads the cloud and the model, everything it produces goes into its own slot
+    auto task = std::make_shared<std::packaged_task<ViewFit()>>([this, cloud]() {
+        ViewFit fit;
+        logger::LogCapture capture(fit.log);
+        fit.planes = get_calibration_planes_coefs(cloud);
+        return fit;
+    });
+    view_tasks.push_back(task->get_future());
+    parallel::default_pool().submit([task]() { (*task)(); });
+}
+
+pcl::PointXYZ model::CalibrationModel::finish_incremental_calibration() {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<ViewFit> fits;
+    fits.reserve(view_tasks.size());
+    for (auto &task : view_tasks) {
+        fits.push_back(task.get());
+    }
+    view_tasks.clear();
+    if (fits.size() < 2) {
+        throw std::runtime_error("Error, need at least two calibration views to calculate the center point");
+    }
+
+    ground_planes.clear();
+    upright_planes.clear();
+    solver = CenterPointSolver();
+    for (const auto &fit : fits) {
+        logger::replay(fit.log);
+        ground_planes.emplace_back(fit.planes[0]);
+        upright_planes.emplace_back(fit.planes[1]);
+        solver.add_view(fit.planes[1]);
+    }
+    axis_of_rotation = calculate_axis_dir(ground_planes);
+    solver.set_axis(axis_of_rotation);
+    solve_center_point();
+    double wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    LOG_INFO("center point ready {} ms after the last capture", wait_ms);
     return center_point;
 }
 
-pcl::PointXYZ model::CalibrationModel::calculate_center_point(const equations::Normal &axis_dir,
-                                                              const std::vector<equations::Plane> &upright_planes) {
-    Eigen::MatrixXd A = build_A_matrix(axis_dir, upright_planes);
-    Eigen::MatrixXd b = build_b_matrix(axis_dir, upright_planes);
+void model::CalibrationModel::set_view_enabled(std::size_t view, bool enabled) {
+    solver.set_view_enabled(view, enabled);
+}
 
-    Eigen::MatrixXd sol_mat = A.bdcSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(b);
-    std::vector<double> sol_vec(sol_mat.data(), sol_mat.data() + sol_mat.rows() * sol_mat.cols());
-    return pcl::PointXYZ(sol_vec[0], sol_vec[1], sol_vec[2]);
+pcl::PointXYZ model::CalibrationModel::solve_center_point() {
+    center_solution = solver.solve();
+    const Eigen::Vector3d &x = center_solution.center;
+    center_point = pcl::PointXYZ(x[0], x[1], x[2]);
+    LOG_INFO("center point from {} view pairs after {} IRLS iterations, residual scale {}",
+             center_solution.pairs, center_solution.iterations, center_solution.scale);
+    for (std::size_t i = 0; i < center_solution.view_weights.size(); i++) {
+        if (solver.is_view_enabled(i) && center_solution.view_weights[i] < .5) {
+            LOG_ERROR("calibration view {} disagrees with the others (weight {}), consider disabling it", i,
+                      center_solution.view_weights[i]);
+        }
+    }
+    LOG_INFO("calculated center point: ({}, {}, {})", center_point.x, center_point.y, center_point.z);
+    return center_point;
+}
 
+const model::CenterPointSolution &model::CalibrationModel::get_center_solution() const {
+    return center_solution;
+}
+
+pcl::PointXYZ model::CalibrationModel::calculate_center_point(const equations::Normal &axis_dir,
+                                                              const std::vector<equations::Plane> &upright_planes) {
+    CenterPointSolver pair_solver;
+    pair_solver.set_axis(axis_dir);
+    for (const auto &upright : upright_planes) {
+        pair_solver.add_view(upright);
+    }
+    Eigen::Vector3d x = pair_solver.solve().center;
+    return pcl::PointXYZ(x[0], x[1], x[2]);
 }
 
 pcl::PointXYZ model::CalibrationModel::refine_center_point(double delta) {
@@ -71,14 +179,17 @@ pcl::PointXYZ model::CalibrationModel::refine_center_point(double delta) {
         throw std::runtime_error("Error, cannot refine because center point has not been calculated yet");
     }
     equations::Plane averaged_ground_plane = algos::average_planes(ground_planes);
-    // just use the first calibration as the candidate to find a point from. in the future i can use
-    // more statistical methods to determine which is the best calibration to find the best calibration to extract from
-    pcl::PointXYZ plane_pt = algos::find_point_in_plane(clouds[0], averaged_ground_plane, delta);
-    center_point = algos::project_point_to_plane(center_point, plane_pt, averaged_ground_plane.get_normal());
-    logger::info("refined calculated center point: (" +
-                 std::to_string(center_point.x) + ", " +
-                 std::to_string(center_point.y) + ", " +
-                 std::to_string(center_point.z) + ")");
+    // every calibration view sees the ground, so anchor the plane on all of their ground points
+    algos::PlanePointQuery ground = algos::query_plane_points(clouds, averaged_ground_plane, delta);
+    if (!ground.found) {
+        LOG_ERROR("cannot find ground points within {} of the averaged ground plane, try loosening it", delta);
+        return center_point;
+    }
+    LOG_INFO("refining with {} ground points, mean distance {}, rms {}, max {}", ground.inliers,
+             ground.mean_distance, ground.rms_distance, ground.max_abs_distance);
+    center_point = algos::project_point_to_plane(center_point, ground.least_squares_point,
+                                                 averaged_ground_plane.get_normal());
+    LOG_INFO("refined calculated center point: ({}, {}, {})", center_point.x, center_point.y, center_point.z);
     return center_point;
 }
 
@@ -97,118 +208,82 @@ std::vector<equations::Plane>
 model::CalibrationModel::get_calibration_planes_coefs(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
                                                       bool visual_flag) {
 
-    std::vector < std::shared_ptr < pcl::PointCloud < pcl::PointXYZ>>> clouds;
     std::vector <equations::Plane> planes;
 
-    auto cloud_cpy = std::make_shared < pcl::PointCloud < pcl::PointXYZ >> ();
-    *cloud_cpy = *cloud;
-    auto cloud_plane = std::make_shared < pcl::PointCloud < pcl::PointXYZ >> ();
-    auto cloud_normals = std::make_shared < pcl::PointCloud < pcl::Normal >> ();
-
-    // calculate the normals
-    pcl::NormalEstimation <pcl::PointXYZ, pcl::Normal> ne;
-    auto tree = std::make_shared < pcl::search::KdTree < pcl::PointXYZ >> ();
-    ne.setSearchMethod(tree);
-    ne.setInputCloud(cloud_cpy);
-    ne.setKSearch(50);
-    ne.compute(*cloud_normals);
-
-    auto ground_coeff = std::make_shared<pcl::ModelCoefficients>();
-    auto inliers = std::make_shared<pcl::PointIndices>();
-    pcl::SACSegmentationFromNormals <pcl::PointXYZ, pcl::Normal> seg;
-
-    seg.setOptimizeCoefficients(true);
-    seg.setModelType(pcl::SACMODEL_NORMAL_PARALLEL_PLANE);
-    seg.setNormalDistanceWeight(0.02);
-    seg.setMethodType(pcl::SAC_RANSAC);
-    seg.setMaxIterations(10000);
-    seg.setDistanceThreshold(0.005);
-    seg.setInputCloud(cloud_cpy);
-    seg.setInputNormals(cloud_normals);
-    // set hardcoded ground normal axis value with wide epsilon value
-    seg.setAxis(Eigen::Vector3f(.00295, -.7803, -.3831));
-    seg.setEpsAngle(0.523599);
-    seg.segment(*inliers, *ground_coeff);
+    // normals for every point of the cloud, the cloud itself is never copied
+    pcl::PointCloud<pcl::Normal> normals;
+    if (cloud->isOrganized()) {
+        // straight off the depth grid, integral images average the same ~50 neighbors a K = 50 search would
+        normals = algos::estimate_integral_normals(*cloud, 3, .01);
+    } else {
+        // e.g. a voxelized cloud from an older calibration pipeline
+        pcl::NormalEstimationOMP <pcl::PointXYZ, pcl::Normal> ne;
+        auto tree = std::make_shared < pcl::search::KdTree < pcl::PointXYZ >> ();
+        ne.setSearchMethod(tree);
+        ne.setInputCloud(cloud);
+        ne.setKSearch(50);
+        ne.compute(normals);
+    }
+
+    // gathered once, both fits score against the same buffers and the upright fit just masks out the ground
+    const algos::PlaneFitData data = algos::PlaneFitData::gather(*cloud, &normals, nullptr);
+
+    auto to_coefficients = [](const algos::PlaneFitResult &fit) {
+        auto coeff = std::make_shared<pcl::ModelCoefficients>();
+        coeff->values.assign(fit.coefficients.data(), fit.coefficients.data() + 4);
+        return coeff;
+    };
+    auto visualize = [&cloud](const std::vector<int> &inliers) {
+        auto cloud_plane = std::make_shared < pcl::PointCloud < pcl::PointXYZ >> (*cloud, inliers);
+        std::vector < std::shared_ptr < pcl::PointCloud < pcl::PointXYZ>>> clouds = {cloud, cloud_plane};
+        visual::Visualizer::simpleVis(clouds);
+    };
 
-    if (inliers->indices.empty()) {
+    algos::PlaneFitParams ground_params;
+    ground_params.normal_distance_weight = 0.02;
+    ground_params.max_iterations = 10000;
+    ground_params.distance_threshold = 0.005;
+    // set hardcoded ground normal axis value with wide epsilon value
+    ground_params.axis = Eigen::Vector3f(.00295, -.7803, -.3831);
+    ground_params.eps_angle = 0.523599;
+    algos::PlaneFitResult ground_fit = algos::fit_plane_ransac(data, nullptr, ground_params);
+    auto ground_coeff = to_coefficients(ground_fit);
+    LOG_DEBUG("ground RANSAC stopped after {} iterations, {} fully scored", ground_fit.iterations,
+              ground_fit.full_scores);
+
+    if (ground_fit.inliers.empty()) {
         PCL_ERROR("Could not estimate a planar model for the given dataset.");
     }
 
     planes.emplace_back(ground_coeff);
 
-    std::cerr << "Model coefficients: " << ground_coeff->values[0] << " "
-              << ground_coeff->values[1] << " "
-              << ground_coeff->values[2] << " "
-              << ground_coeff->values[3] << std::endl;
-
-    logger::info("Ground model coefficients: (" +
-                 std::to_string(ground_coeff->values[0]) + "," +
-                 std::to_string(ground_coeff->values[1]) + "," +
-                 std::to_string(ground_coeff->values[2]) + "," +
-                 std::to_string(ground_coeff->values[3]) + ",");
-
-    pcl::ExtractIndices <pcl::PointXYZ> extract;
-    pcl::ExtractIndices <pcl::Normal> extract_normals;
-    extract.setInputCloud(cloud_cpy);
-    extract.setIndices(inliers);
-    extract.setNegative(false);
-
-    // Get the points associated with the planar surface
-    extract.filter(*cloud_plane);
+    LOG_INFO("Ground model coefficients: ({}, {}, {}, {})", ground_coeff->values[0], ground_coeff->values[1],
+             ground_coeff->values[2], ground_coeff->values[3]);
 
     if (visual_flag) {
-        clouds = {cloud_cpy, cloud_plane};
-        visual::Visualizer::simpleVis(clouds);
+        visualize(ground_fit.inliers);
     }
 
-    // Remove the planar inliers, extract the rest
-    extract.setNegative(true);
-    extract.filter(*cloud_cpy);
-
-    // remove normal inliers
-    extract_normals.setNegative(true);
-    extract_normals.setInputCloud(cloud_normals);
-    extract_normals.setIndices(inliers);
-    extract_normals.filter(*cloud_normals);
+    // LETS GET THE UPRIGHT PLANE!! everything that isn't ground
+    algos::PlaneMask not_ground = ground_fit.found ? algos::PlaneMask(!ground_fit.inlier_mask)
+                                                   : algos::PlaneMask::Constant(data.size(), true);
 
-    // LETS GET THE UPRIGHT PLANE!!
-
-    auto up_coeff = std::make_shared<pcl::ModelCoefficients>();
-    pcl::SACSegmentationFromNormals <pcl::PointXYZ, pcl::Normal> seg2;
-
-    seg2.setOptimizeCoefficients(true);
-    seg2.setModelType(pcl::SACMODEL_NORMAL_PLANE);
-    seg2.setNormalDistanceWeight(0.02);
-    seg2.setMethodType(pcl::SAC_RANSAC);
-    seg2.setMaxIterations(10000);
-    seg2.setDistanceThreshold(0.003);
-    seg2.setInputCloud(cloud_cpy);
-    seg2.setInputNormals(cloud_normals);
-    seg2.segment(*inliers, *up_coeff);
+    algos::PlaneFitParams up_params;
+    up_params.normal_distance_weight = 0.02;
+    up_params.max_iterations = 10000;
+    up_params.distance_threshold = 0.003;
+    algos::PlaneFitResult up_fit = algos::fit_plane_ransac(data, &not_ground, up_params);
+    auto up_coeff = to_coefficients(up_fit);
+    LOG_DEBUG("upright RANSAC stopped after {} iterations, {} fully scored", up_fit.iterations,
+              up_fit.full_scores);
 
     planes.emplace_back(up_coeff);
 
-    std::cerr << "Up Model coefficients: " << up_coeff->values[0] << " "
-              << up_coeff->values[1] << " "
-              << up_coeff->values[2] << " "
-              << up_coeff->values[3] << std::endl;
-
-    logger::info("Upright model coefficients: (" +
-                 std::to_string(up_coeff->values[0]) + "," +
-                 std::to_string(up_coeff->values[1]) + "," +
-                 std::to_string(up_coeff->values[2]) + "," +
-                 std::to_string(up_coeff->values[3]) + ",");
-
-    extract.setInputCloud(cloud_cpy);
-    extract.setIndices(inliers);
-    extract.setNegative(false);
-
-    // Get the points associated with the planar surface
-    extract.filter(*cloud_plane);
+    LOG_INFO("Upright model coefficients: ({}, {}, {}, {})", up_coeff->values[0], up_coeff->values[1],
+             up_coeff->values[2], up_coeff->values[3]);
 
     if (visual_flag) {
-        clouds = {cloud_cpy, cloud_plane};
-        visual::Visualizer::simpleVis(clouds);
+        visualize(up_fit.inliers);
     }
 
     auto ground_vect = Eigen::Vector3f(ground_coeff->values[0], ground_coeff->values[1], ground_coeff->values[2]);
@@ -217,8 +292,7 @@ model::CalibrationModel::get_calibration_planes_coefs(const std::shared_ptr<pcl:
     double angle = std::atan2(ground_vect.cross(up_vect).norm(), ground_vect.dot(up_vect));
     double angle_deg = angle * (180.0 / 3.141592653589793238463);
     double error = abs((angle_deg - 90) / 90.0) * 100.0;
-    logger::info("angle between two planes: " + std::to_string(angle_deg) +
-                 ", error: " + std::to_string(error));
+    LOG_INFO("angle between two planes: {}, error: {}", angle_deg, error);
 
     return planes;
 }
@@ -4,13 +4,20 @@
 #include "IModel.h"
 #include "CalibrationFileHandler.h"
 #include "Normal.h"
+#include "FilterPipeline.h"
+#include "CenterPointSolver.h"
 #include <pcl/point_types.h>
 #include <Eigen/Dense>
+#include <future>
 
 namespace file {
     class CalibrationFileHandler;
 }
 
+namespace camera {
+    struct intrinsics;
+}
+
 namespace equations {
     class Normal;
 
@@ -32,6 +39,11 @@ namespace model {
          */
         CalibrationModel();
 
+        /**
+         * Waits for plane fits that are still queued.
+         */
+        ~CalibrationModel();
+
         /**
          * Set the calibration name. This triggers the filehandler to set the current working directory
          * to the given input. This will also clear any existing clouds in the model.
@@ -45,11 +57,22 @@ namespace model {
          */
         void save_cloud(const std::string &cloud_name);
 
+        /**
+         * Run the calibration filter pipeline on a freshly captured cloud in place.
+         * The pipeline is read from "calibration_filter_pipeline" in settings/config.json the first time this
+         * is called for a calibration. Stage stats go to pipeline.json in the calibration folder.
+         *
+         * @param cloud cloud to filter.
+         * @param cloud_name name the cloud will be saved under.
+         */
+        void filter_cloud(std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud, const std::string &cloud_name);
+
 
         /**
          * Calculate the center point of the turntable.
          * Using vector of clouds, find the ground and upright planes, get the axis of rotation,
-         * build A and b matrices, and finally solve for the center point x using in Ax = b using SVD.
+         * and solve for the center point over every pair of upright planes with CenterPointSolver.
+         * The views are segmented in parallel, planes and logs are kept in view order.
          *
          * @param axis_dir axis of rotation direction.
          * @param upright_planes use the upright planes in calculation.
@@ -57,6 +80,61 @@ namespace model {
          */
         pcl::PointXYZ calculate_center_point();
 
+        /**
+         * Fuse depth frames of the empty rig into a per pixel median and cache it with the calibration as the
+         * background for scans. Pixels measured in fewer than half of the frames get no background.
+         *
+         * @param frames raw depth frames of the empty turntable.
+         * @param intrinsics intrinsics of the frames.
+         * @throws invalid_argument if there are no frames or their sizes differ.
+         */
+        void save_background(const std::vector<std::vector<uint16_t>> &frames, const camera::intrinsics &intrinsics);
+
+        /**
+         * Start fitting planes while the calibration is captured. Drops fits queued for an earlier calibration.
+         */
+        void start_incremental_calibration();
+
+        /**
+         * Queue the plane fit of a captured view on the shared pool and return right away, so the turntable
+         * can move on to the next view. Views are fitted in parallel, each into its own slot, and only reach
+         * the center point solver in capture order once finish_incremental_calibration collects them.
+         *
+         * @param cloud_name name of a filtered cloud added to the model.
+         */
+        void fit_view_async(const std::string &cloud_name);
+
+        /**
+         * Wait for the queued fits, add their planes and logs in capture order and solve for the center point,
+         * same as calculate_center_point over the fitted views.
+         *
+         * @return center point of turntable from the camera origin in meters.
+         * @throws runtime_error if fewer than two views were fitted.
+         */
+        pcl::PointXYZ finish_incremental_calibration();
+
+        /**
+         * Leave a calibration view out of the center point solve or put it back, e.g. after
+         * get_center_solution shows it disagrees with the others. Call resolve_center_point afterwards.
+         *
+         * @throws out_of_range for a view that doesn't exist.
+         */
+        void set_view_enabled(std::size_t view, bool enabled);
+
+        /**
+         * Solve again with the current views, cheap since the planes are kept. Replaces a refined center point.
+         *
+         * @return center point of turntable from the camera origin in meters.
+         */
+        pcl::PointXYZ resolve_center_point() {
+            return solve_center_point();
+        }
+
+        /**
+         * @return pairs, iterations and per view weights of the last solve.
+         */
+        const CenterPointSolution &get_center_solution() const;
+
         /**
          * Overloaded method also accepts axis direction planes instead of using model's.
          *
@@ -69,11 +147,10 @@ namespace model {
 
 
         /**
-         * Project center point to ground plane.
+         * Project center point to ground plane. The plane is the averaged ground plane moved onto the centroid
+         * of every point within delta of it in all calibration views.
          *
-         * @param cloud the calibration that the plane you are projecting to belongs to.
-         * @param pt point you want to project.
-         * @param delta the threshold to search for point on plane.
+         * @param delta the threshold to search for points on the plane.
          * @return projected point on the plane.
          * @throws if the center point has not been calculated yet.
          */
@@ -87,17 +164,40 @@ namespace model {
 
     private:
         file::CalibrationFileHandler file_handler;
+        std::unique_ptr<FilterPipeline> pipeline;
+        nlohmann::json pipeline_stats;
         std::vector<equations::Plane> ground_planes;
         std::vector<equations::Plane> upright_planes;
         pcl::PointXYZ center_point;
         equations::Normal axis_of_rotation;
 
+        CenterPointSolver solver;
+        CenterPointSolution center_solution;
+
+        /**
+         * Planes of a view fitted in the background and the log messages written while fitting it.
+         */
+        struct ViewFit {
+            std::vector<equations::Plane> planes;
+            logger::LogBuffer log;
+        };
+
+        /**
+         * One slot per queued view in capture order, waited on by the destructor.
+         */
+        std::vector<std::future<ViewFit>> view_tasks;
+
 
         /**
          * Get the upright and ground plane equations.
          * Utilizes a hardcoded axis and RANSAC normals to find the ground plane. It finds a plane that is within
          * the epsilon angle deviation to robustly find the ground plane. Then it will calculate the normals
          * and find the perpendicular plane which should be the upright pane.
+         * Normals come from integral images of the pixel grid for organized clouds, and from a multithreaded
+         * K = 50 neighbor search otherwise.
+         * Points and normals are gathered once and both fits share them, the upright fit masks out the ground
+         * inliers instead of extracting copies.
+         * Only reads the model, so several clouds can be segmented at once.
          *
          * @param cloud calibration calibration.
          * @param visual_flag flag whether to visualize segmentation or not.
@@ -107,6 +207,11 @@ namespace model {
         get_calibration_planes_coefs(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
                                      bool visual_flag = false);
 
+        /**
+         * Solve with the current solver state, store and log the result.
+         */
+        pcl::PointXYZ solve_center_point();
+
         /**
           * Calculate the A matrix in Ax = b
           * @param g_n normal vector to the ground plane.
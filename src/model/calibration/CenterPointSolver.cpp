@@ -0,0 +1,154 @@
+#include "CenterPointSolver.h"
+#include "Equations.h"
+#include <Eigen/SVD>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace {
+    struct PairRow {
+        std::size_t i;
+        std::size_t j;
+        Eigen::Vector3d a;
+        double b;
+    };
+
+    /**
+     * Minimum norm solution of the 3x3 normal equations, the system has no information along the axis.
+     */
+    Eigen::Vector3d solve_normal_equations(const Eigen::Matrix3d &M, const Eigen::Vector3d &v) {
+        Eigen::JacobiSVD<Eigen::Matrix3d> svd(M, Eigen::ComputeFullU | Eigen::ComputeFullV);
+        svd.setThreshold(1e-9);
+        return svd.solve(v);
+    }
+
+    double median(std::vector<double> values) {
+        auto mid = values.begin() + values.size() / 2;
+        std::nth_element(values.begin(), mid, values.end());
+        return *mid;
+    }
+}
+
+model::CenterPointSolver::CenterPointSolver(CenterPointParams params) : params(params) {}
+
+void model::CenterPointSolver::set_axis(const equations::Normal &axis) {
+    this->axis = axis;
+    for (auto &view : views) {
+        scale_view(view);
+    }
+}
+
+std::size_t model::CenterPointSolver::add_view(const equations::Plane &upright) {
+    View view{upright, Eigen::Vector3d::Zero(), 0, true};
+    scale_view(view);
+    views.push_back(view);
+    return views.size() - 1;
+}
+
+void model::CenterPointSolver::set_view_enabled(std::size_t view, bool enabled) {
+    if (view >= views.size()) {
+        throw std::out_of_range("no calibration view " + std::to_string(view));
+    }
+    views[view].enabled = enabled;
+}
+
+bool model::CenterPointSolver::is_view_enabled(std::size_t view) const {
+    if (view >= views.size()) {
+        throw std::out_of_range("no calibration view " + std::to_string(view));
+    }
+    return views[view].enabled;
+}
+
+std::size_t model::CenterPointSolver::num_views() const {
+    return views.size();
+}
+
+model::CenterPointSolution model::CenterPointSolver::solve() const {
+    std::vector<std::size_t> enabled;
+    for (std::size_t i = 0; i < views.size(); i++) {
+        if (views[i].enabled) {
+            enabled.push_back(i);
+        }
+    }
+    if (enabled.size() < 2) {
+        throw std::runtime_error("need at least two enabled calibration views to solve for the center point");
+    }
+
+    // same rows as build_A_matrix / build_b_matrix, for every pair or only neighbors
+    std::vector<PairRow> rows;
+    for (std::size_t p = 0; p < enabled.size(); p++) {
+        std::size_t last = params.all_pairs ? enabled.size() : std::min(p + 2, enabled.size());
+        for (std::size_t q = p + 1; q < last; q++) {
+            const View &vi = views[enabled[p]];
+            const View &vj = views[enabled[q]];
+            rows.push_back({enabled[p], enabled[q], vi.scaled_normal - vj.scaled_normal,
+                            vj.scaled_offset - vi.scaled_offset});
+        }
+    }
+
+    CenterPointSolution solution;
+    solution.pairs = rows.size();
+    std::vector<double> weights(rows.size(), 1.0);
+    std::vector<double> residuals(rows.size());
+    Eigen::Vector3d center = Eigen::Vector3d::Zero();
+    for (int iteration = 0; iteration < std::max(params.max_iterations, 1); iteration++) {
+        Eigen::Matrix3d M = Eigen::Matrix3d::Zero();
+        Eigen::Vector3d v = Eigen::Vector3d::Zero();
+        for (std::size_t r = 0; r < rows.size(); r++) {
+            M.noalias() += weights[r] * rows[r].a * rows[r].a.transpose();
+            v += weights[r] * rows[r].b * rows[r].a;
+        }
+        Eigen::Vector3d next = solve_normal_equations(M, v);
+        double step = (next - center).norm();
+        center = next;
+        solution.iterations = iteration + 1;
+
+        // Cauchy weights with a scale from the median absolute residual
+        for (std::size_t r = 0; r < rows.size(); r++) {
+            residuals[r] = std::abs(rows[r].a.dot(center) - rows[r].b);
+        }
+        solution.scale = std::max(2.3849 * 1.4826 * median(residuals), params.min_scale);
+        for (std::size_t r = 0; r < rows.size(); r++) {
+            double u = residuals[r] / solution.scale;
+            weights[r] = 1 / (1 + u * u);
+        }
+        if (iteration > 0 && step < params.tolerance) {
+            break;
+        }
+    }
+
+    solution.center = center;
+    solution.view_weights.assign(views.size(), 0);
+    std::vector<int> counts(views.size(), 0);
+    for (std::size_t r = 0; r < rows.size(); r++) {
+        solution.view_weights[rows[r].i] += weights[r];
+        solution.view_weights[rows[r].j] += weights[r];
+        counts[rows[r].i]++;
+        counts[rows[r].j]++;
+    }
+    for (std::size_t i = 0; i < views.size(); i++) {
+        if (counts[i] > 0) {
+            solution.view_weights[i] /= counts[i];
+        }
+    }
+    return solution;
+}
+
+const model::CenterPointParams &model::CenterPointSolver::get_params() const {
+    return params;
+}
+
+void model::CenterPointSolver::set_params(const CenterPointParams &params) {
+    this->params = params;
+}
+
+void model::CenterPointSolver::scale_view(View &view) const {
+    double k = equations::coeff(axis, view.plane.get_normal());
+    if (!std::isfinite(k)) {
+        // no axis yet or a plane parallel to the ground, keep it out of the rows
+        k = 0;
+    }
+    view.scaled_normal = k * Eigen::Vector3d(view.plane.A, view.plane.B, view.plane.C);
+    view.scaled_offset = k * view.plane.D;
+}
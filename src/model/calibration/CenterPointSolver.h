@@ -0,0 +1,102 @@
+#ifndef SWAG_SCANNER_CENTERPOINTSOLVER_H
+#define SWAG_SCANNER_CENTERPOINTSOLVER_H
+
+#include "Normal.h"
+#include "Plane.h"
+#include <Eigen/Core>
+#include <vector>
+
+namespace model {
+
+    struct CenterPointParams {
+        /**
+         * Use every pair of enabled views instead of only consecutive ones. A view that is off then shows up
+         * in many rows that disagree with the rest, which is what lets IRLS spot it.
+         */
+        bool all_pairs = true;
+
+        int max_iterations = 20;
+
+        /**
+         * Stop when the center moves less than this (meters) between iterations.
+         */
+        double tolerance = 1e-9;
+
+        /**
+         * Floor for the robust residual scale, so perfect data doesn't divide by zero.
+         */
+        double min_scale = 1e-6;
+    };
+
+    struct CenterPointSolution {
+        Eigen::Vector3d center = Eigen::Vector3d::Zero();
+        std::vector<double> view_weights;   /** mean Cauchy weight of the pairs of each view, 0 if disabled */
+        std::size_t pairs = 0;
+        int iterations = 0;
+        double scale = 0;                   /** robust residual scale of the last iteration */
+    };
+
+    /**
+     * Solves for the turntable center from the upright calibration planes.
+     * Every upright plane is the same plane rotated about the axis, so the distance from the center to each
+     * of them, divided by the sine of the angle between its normal and the axis, is the same. Each pair of
+     * views gives one row (k_i n_i - k_j n_j) x = k_j D_j - k_i D_i of build_A_matrix and build_b_matrix.
+     * Rows go straight into 3x3 normal equations, then iteratively reweighted least squares with Cauchy
+     * weights pushes down pairs with large residuals, so a bad view loses its influence.
+     * Views only store their scaled normal and offset, a solve is O(pairs) on fixed size Eigen types and
+     * cheap enough to repeat whenever a view is added, enabled or disabled.
+     */
+    class CenterPointSolver {
+    public:
+        explicit CenterPointSolver(CenterPointParams params = CenterPointParams());
+
+        /**
+         * Set the axis of rotation. Rescales every view.
+         */
+        void set_axis(const equations::Normal &axis);
+
+        /**
+         * @return index of the new view, enabled.
+         */
+        std::size_t add_view(const equations::Plane &upright);
+
+        /**
+         * Leave a view out of (or put it back into) the solve.
+         *
+         * @throws out_of_range for a view that doesn't exist.
+         */
+        void set_view_enabled(std::size_t view, bool enabled);
+
+        bool is_view_enabled(std::size_t view) const;
+
+        std::size_t num_views() const;
+
+        /**
+         * The center is only defined up to a shift along the axis, the minimum norm solution is returned like
+         * the SVD solve does. Project it onto the ground plane afterwards.
+         *
+         * @throws runtime_error if fewer than two views are enabled.
+         */
+        CenterPointSolution solve() const;
+
+        const CenterPointParams &get_params() const;
+
+        void set_params(const CenterPointParams &params);
+
+    private:
+        struct View {
+            equations::Plane plane;
+            Eigen::Vector3d scaled_normal; /** k n */
+            double scaled_offset;          /** k D */
+            bool enabled;
+        };
+
+        CenterPointParams params;
+        equations::Normal axis;
+        std::vector<View> views;
+
+        void scale_view(View &view) const;
+    };
+}
+
+#endif //SWAG_SCANNER_CENTERPOINTSOLVER_H
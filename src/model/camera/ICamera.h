@@ -53,6 +53,7 @@ namespace camera {
 
         /**
          * Create new pointcloud given depth frame and intrinsics.
+         * The cloud is organized like the frame, pixels with depth 0 become NaN points.
          */
         virtual std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>
         create_point_cloud(const std::vector<uint16_t> &depth_frame,
@@ -3,6 +3,7 @@
 #include "IFileHandler.h"
 #include "Logger.h"
 #include <librealsense2/rsutil.h>
+#include <limits>
 #include <spdlog/spdlog.h>
 #include <nlohmann/json.hpp>
 
@@ -152,12 +153,18 @@ camera::SR305::create_point_cloud(const std::vector<uint16_t> &depth_frame, cons
     cloud->width = intrinsics.width;
     cloud->is_dense = true;
     cloud->points.resize(intrinsics.width * intrinsics.height);
+    const float nan = std::numeric_limits<float>::quiet_NaN();
     for (int y = 0; y < intrinsics.height; y++) {
         for (int x = 0; x < intrinsics.width; x++) {
 
             uint16_t depth = depth_frame[y * intrinsics.width + x];
             float depth_in_meters = depth * intrinsics.depth_scale;
-            if (depth == 0) continue;
+            if (depth == 0) {
+                // no measurement (or subtracted background), NaN keeps the grid organized
+                cloud->points[y * intrinsics.width + x] = pcl::PointXYZ(nan, nan, nan);
+                cloud->is_dense = false;
+                continue;
+            }
             float pixel[2] = {(float) x, (float) y};
             float point_array[3] = {(float) x, (float) y, 0};
             const rs2_intrinsics intrin = {intrinsics.width, intrinsics.height,
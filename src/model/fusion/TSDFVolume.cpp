@@ -0,0 +1,201 @@
+#include "TSDFVolume.h"
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+    /**
+     * Fixed so a key always lands in the same shard, whatever the number of threads.
+     */
+    constexpr std::size_t NUM_SHARDS = 64;
+
+    /**
+     * Voxel coordinates are offset by this so negative positions get non-negative keys.
+     */
+    constexpr int64_t KEY_BIAS = int64_t(1) << (algos::VOXEL_KEY_BITS - 1);
+
+    /**
+     * Signed distances one view puts into one voxel.
+     */
+    struct ViewSample {
+        float sum = 0;
+        uint32_t count = 0;
+    };
+
+    bool is_finite(const pcl::PointXYZ &p) {
+        return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+    }
+}
+
+fusion::TSDFVolume::TSDFVolume(float voxel_size, float truncation, float max_weight) :
+        voxel_size(voxel_size), truncation(truncation), max_weight(max_weight), shards(NUM_SHARDS) {
+    if (!(voxel_size > 0) || !(max_weight > 0)) {
+        throw std::invalid_argument("TSDF voxel size and max weight must be positive");
+    }
+    if (!(truncation >= voxel_size)) {
+        throw std::invalid_argument("TSDF truncation distance must be at least one voxel");
+    }
+}
+
+void fusion::TSDFVolume::integrate(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                   const Eigen::Matrix4f &pose,
+                                   const Eigen::Vector3f &camera_origin) {
+    const std::size_t n = cloud.size();
+    const int half = int(std::ceil(truncation / voxel_size));
+    const std::size_t samples = std::size_t(2 * half + 1);
+    const std::size_t grain = 1 << 14;
+    const Eigen::Matrix3f rot = pose.topLeftCorner<3, 3>();
+    const Eigen::Vector3f trans = pose.topRightCorner<3, 1>();
+    const Eigen::Vector3f camera = rot * camera_origin + trans;
+
+    // every point gets a fixed run of samples along its ray, empty keys for the ones that don't count
+    std::vector<Eigen::Vector3f> points(n);
+    std::vector<Eigen::Vector3f> rays(n);
+    std::vector<uint64_t> keys(n * samples, algos::VoxelHashMap<TSDFVoxel>::EMPTY_KEY);
+    parallel::for_each_range(n, grain, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            if (!is_finite(cloud.points[i])) {
+                continue;
+            }
+            points[i] = rot * cloud.points[i].getVector3fMap() + trans;
+            Eigen::Vector3f ray = points[i] - camera;
+            float length = ray.norm();
+            if (length < voxel_size) {
+                continue;
+            }
+            rays[i] = ray / length;
+            uint64_t previous = algos::VoxelHashMap<TSDFVoxel>::EMPTY_KEY;
+            for (std::size_t s = 0; s < samples; s++) {
+                float offset = float(int(s) - half) * voxel_size;
+                uint64_t key = key_of(points[i] + rays[i] * offset);
+                // oblique rays can hit a voxel twice, one vote per point is enough
+                if (key != previous) {
+                    keys[i * samples + s] = key;
+                }
+                previous = key;
+            }
+        }
+    });
+
+    // average the view's samples per voxel first, with the same sharding as the volume
+    std::vector<algos::VoxelHashMap<ViewSample>> view(shards.size());
+    algos::shard_accumulate_voxels(keys, view, [&](ViewSample &sample, std::size_t k, bool) {
+        const std::size_t i = k / samples;
+        // distance from the voxel center to the point along the ray, positive on the camera side
+        float sdf = rays[i].dot(points[i] - center_of(keys[k]));
+        sample.sum += std::max(-1.0f, std::min(1.0f, sdf / truncation));
+        sample.count++;
+    });
+
+    // then the view counts as one observation, so weights are in views no matter the point density
+    parallel::for_each_index(shards.size(), [&](std::size_t s) {
+        auto &volume = shards[s];
+        const auto &samples_of_view = view[s];
+        volume.reserve(volume.size() + samples_of_view.size());
+        for (std::size_t slot = 0; slot < samples_of_view.capacity(); slot++) {
+            const uint64_t key = samples_of_view.slot_key(slot);
+            if (key == algos::VoxelHashMap<ViewSample>::EMPTY_KEY) {
+                continue;
+            }
+            const ViewSample &sample = samples_of_view.slot_value(slot);
+            TSDFVoxel &voxel = volume[key];
+            voxel.tsdf = (voxel.tsdf * voxel.weight + sample.sum / float(sample.count)) / (voxel.weight + 1);
+            voxel.weight = std::min(voxel.weight + 1, max_weight);
+        }
+    });
+}
+
+pcl::PointCloud<pcl::PointXYZ> fusion::TSDFVolume::extract_surface(float min_weight) const {
+    auto usable = [min_weight](const TSDFVoxel &voxel) {
+        return voxel.weight >= min_weight && std::abs(voxel.tsdf) < 1;
+    };
+
+    std::vector<std::vector<pcl::PointXYZ>> found(shards.size());
+    parallel::for_each_index(shards.size(), [&](std::size_t s) {
+        const auto &map = shards[s];
+        for (std::size_t slot = 0; slot < map.capacity(); slot++) {
+            const uint64_t key = map.slot_key(slot);
+            if (key == algos::VoxelHashMap<TSDFVoxel>::EMPTY_KEY || !usable(map.slot_value(slot))) {
+                continue;
+            }
+            const TSDFVoxel &voxel = map.slot_value(slot);
+            uint32_t v[3];
+            algos::unpack_voxel_key(key, v[0], v[1], v[2]);
+            const Eigen::Vector3f center = center_of(key);
+            // the +x, +y and +z edges, so every edge of the volume is looked at once
+            for (int axis = 0; axis < 3; axis++) {
+                uint32_t next[3] = {v[0], v[1], v[2]};
+                if (++next[axis] > algos::VOXEL_KEY_MAX) {
+                    continue;
+                }
+                const TSDFVoxel *neighbor = find(algos::pack_voxel_key(next[0], next[1], next[2]));
+                if (neighbor == nullptr || !usable(*neighbor) || (voxel.tsdf >= 0) == (neighbor->tsdf >= 0)) {
+                    continue;
+                }
+                Eigen::Vector3f pt = center;
+                pt[axis] += voxel_size * voxel.tsdf / (voxel.tsdf - neighbor->tsdf);
+                found[s].emplace_back(pt[0], pt[1], pt[2]);
+            }
+        }
+    });
+
+    pcl::PointCloud<pcl::PointXYZ> surface;
+    std::size_t total = 0;
+    for (const auto &points : found) {
+        total += points.size();
+    }
+    surface.points.reserve(total);
+    for (const auto &points : found) {
+        surface.points.insert(surface.points.end(), points.begin(), points.end());
+    }
+    surface.width = surface.points.size();
+    surface.height = 1;
+    surface.is_dense = true;
+    return surface;
+}
+
+const fusion::TSDFVoxel *fusion::TSDFVolume::find(const Eigen::Vector3f &pt) const {
+    uint64_t key = key_of(pt);
+    if (key == algos::VoxelHashMap<TSDFVoxel>::EMPTY_KEY) {
+        return nullptr;
+    }
+    return find(key);
+}
+
+std::size_t fusion::TSDFVolume::size() const {
+    std::size_t total = 0;
+    for (const auto &map : shards) {
+        total += map.size();
+    }
+    return total;
+}
+
+float fusion::TSDFVolume::get_voxel_size() const {
+    return voxel_size;
+}
+
+float fusion::TSDFVolume::get_truncation() const {
+    return truncation;
+}
+
+uint64_t fusion::TSDFVolume::key_of(const Eigen::Vector3f &pt) const {
+    uint32_t v[3];
+    for (int axis = 0; axis < 3; axis++) {
+        int64_t coord = int64_t(std::floor(pt[axis] / voxel_size)) + KEY_BIAS;
+        if (coord < 0 || coord > int64_t(algos::VOXEL_KEY_MAX)) {
+            return algos::VoxelHashMap<TSDFVoxel>::EMPTY_KEY;
+        }
+        v[axis] = uint32_t(coord);
+    }
+    return algos::pack_voxel_key(v[0], v[1], v[2]);
+}
+
+Eigen::Vector3f fusion::TSDFVolume::center_of(uint64_t key) const {
+    uint32_t x, y, z;
+    algos::unpack_voxel_key(key, x, y, z);
+    Eigen::Vector3f index(float(int64_t(x) - KEY_BIAS), float(int64_t(y) - KEY_BIAS), float(int64_t(z) - KEY_BIAS));
+    return (index.array() + .5f).matrix() * voxel_size;
+}
+
+const fusion::TSDFVoxel *fusion::TSDFVolume::find(uint64_t key) const {
+    return shards[algos::voxel_shard(key, shards.size())].find(key);
+}
@@ -0,0 +1,94 @@
+#ifndef SWAG_SCANNER_TSDFVOLUME_H
+#define SWAG_SCANNER_TSDFVOLUME_H
+
+#include "VoxelHashMap.h"
+#include <Eigen/Core>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+/**
+ * Volumetric fusion of registered views.
+ */
+namespace fusion {
+
+    /**
+     * Running weighted average of the truncated signed distance of one voxel, in units of the truncation
+     * distance. Positive is in front of the surface (towards the camera). The weight is the number of views
+     * that saw the voxel.
+     */
+    struct TSDFVoxel {
+        float tsdf = 0;
+        float weight = 0;
+    };
+
+    /**
+     * Sparse truncated signed distance volume. Only voxels within the truncation distance of a measured point
+     * are allocated, so memory follows the surface area instead of the bounding box.
+     * Voxels are split into a fixed number of hash map shards that are updated in parallel without locks;
+     * every shard sees its samples in view and point order, so the volume does not depend on thread timing.
+     */
+    class TSDFVolume {
+    public:
+
+        /**
+         * @param voxel_size edge length of a voxel in meters.
+         * @param truncation distance behind and in front of each point that gets updated, at least a voxel.
+         * @param max_weight cap on the voxel weight (views) so later views can still move the surface.
+         * @throws invalid_argument if the sizes aren't positive or truncation < voxel_size.
+         */
+        TSDFVolume(float voxel_size, float truncation, float max_weight = 64);
+
+        /**
+         * Integrate one view. Every finite point is moved by the pose and the voxels along the ray from the
+         * camera through the point, within the truncation distance, get its signed distance. The distances a
+         * view gives one voxel are averaged and added to the voxel with weight 1.
+         *
+         * @param cloud view, organized or not.
+         * @param pose transform from the view into the volume frame, e.g. the turntable pose.
+         * @param camera_origin camera position in the frame of the cloud (before the pose).
+         */
+        void integrate(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                       const Eigen::Matrix4f &pose,
+                       const Eigen::Vector3f &camera_origin);
+
+        /**
+         * Surface points where the signed distance changes sign between two neighboring voxels, interpolated
+         * along the voxel edge. At most three points per voxel, so the output is bounded by the volume size
+         * no matter how many views went in.
+         *
+         * @param min_weight voxels seen by fewer views are ignored, 2 or more drops single view noise.
+         */
+        pcl::PointCloud<pcl::PointXYZ> extract_surface(float min_weight = 1) const;
+
+        /**
+         * @return voxel containing the point or nullptr if it was never updated.
+         */
+        const TSDFVoxel *find(const Eigen::Vector3f &pt) const;
+
+        /**
+         * @return number of allocated voxels.
+         */
+        std::size_t size() const;
+
+        float get_voxel_size() const;
+
+        float get_truncation() const;
+
+    private:
+        float voxel_size;
+        float truncation;
+        float max_weight;
+        std::vector<algos::VoxelHashMap<TSDFVoxel>> shards;
+
+        /**
+         * @return key of the voxel containing pt or EMPTY_KEY if it is outside the addressable range.
+         */
+        uint64_t key_of(const Eigen::Vector3f &pt) const;
+
+        Eigen::Vector3f center_of(uint64_t key) const;
+
+        const TSDFVoxel *find(uint64_t key) const;
+    };
+}
+
+#endif //SWAG_SCANNER_TSDFVOLUME_H
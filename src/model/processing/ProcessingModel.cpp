@@ -1,14 +1,33 @@
 #include "ProcessingModel.h"
+#include "FilterPipeline.h"
 #include "Normal.h"
 #include "Algorithms.h"
 #include "Constants.h"
 #include "Logger.h"
-#include <pcl/registration/icp.h>
+#include "MortonOrder.h"
+#include "Parallel.h"
+#include "PoseGraph.h"
+#include "TSDFVolume.h"
+#include "Transforms.h"
 #include <nlohmann/json.hpp>
+#include <algorithm>
+#include <chrono>
 
 using json = nlohmann::json;
 
-model::ProcessingModel::ProcessingModel() : file_handler() {}
+model::ProcessingModel::ProcessingModel() : file_handler() {
+    json config = file::IFileHandler::get_swag_scanner_config_json();
+    registration::ICPParams params;
+    std::string icp_method = config.value("registration_icp", std::string("point_to_point"));
+    if (icp_method == "point_to_plane") {
+        params.method = registration::ICPMethod::POINT_TO_PLANE;
+    } else if (icp_method != "point_to_point") {
+        throw std::invalid_argument("unknown registration_icp in config.json: " + icp_method);
+    }
+    params.pyramid_leaf_sizes = config.value("registration_pyramid", std::vector<float>());
+    params.full_resolution_iterations = config.value("registration_full_iterations", 5);
+    icp_engine.set_params(params);
+}
 
 std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> model::ProcessingModel::load_cloud(const std::string &name,
                                                                                    const CloudType::Type type) {
@@ -19,6 +38,8 @@ void model::ProcessingModel::set_scan(const std::string &scan_name) {
     file_handler.set_scan(scan_name);
     // TODO: probably decouple loading clouds from this method
     clouds = file_handler.load_clouds(CloudType::Type::RAW);
+    view_normals.clear();
+    icp_engine.clear_views();
     // TODO: dont forget to assign cloud names to the map
 }
 
@@ -33,81 +54,264 @@ void model::ProcessingModel::save_cloud(std::shared_ptr<pcl::PointCloud<pcl::Poi
     file_handler.save_cloud(cloud, cloud_name, cloud_type);
 }
 
-void model::ProcessingModel::filter(int sigma_s,
-                                    float sigma_r,
-                                    int mean_k,
-                                    float thresh_mult) {
-    using namespace constants;
-    int clouds_vector_size = clouds.size();
-    for (int i = 0; i < clouds_vector_size; i++) {
-        crop_cloud(clouds[i],
-                   scan_min_x, scan_max_x,
-                   scan_min_y, scan_max_y,
-                   scan_min_z, scan_max_z);
-        bilateral_filter(clouds[i], sigma_s, sigma_r);
-        remove_nan(clouds[i]);
-        remove_outliers(clouds[i]);
-        // do cloud saving here, try to get the name from the map
-        add_cloud(clouds[i], std::to_string(i) + ".pcd");
+void model::ProcessingModel::filter() {
+    json config = file::IFileHandler::get_swag_scanner_config_json();
+    const FilterPipeline pipeline(FilterPipeline::from_config(config, "scan_filter_pipeline"), *this);
+    const std::size_t num_views = clouds.size();
+    icp_engine.clear_views();
+    std::vector<logger::LogBuffer> view_logs(num_views);
+    std::vector<std::vector<StageStats>> view_stats(num_views);
+    view_normals.assign(num_views, nullptr);
+
+    // views don't depend on each other until registration, so filter and save them on every core
+    parallel::for_each_index(num_views, [&](std::size_t i) {
+        logger::LogCapture capture(view_logs[i]);
+        view_stats[i] = pipeline.run(clouds[i], view_normals[i]);
         save_cloud(clouds[i], std::to_string(i) + ".pcd", CloudType::Type::FILTERED);
+    });
+
+    // back on this thread: name the clouds and write the logs in view order
+    json stats_json = {{"pipeline", pipeline.get_json()},
+                       {"views",    json::array()},
+                       {"totals",   json::array()}};
+    for (std::size_t i = 0; i < num_views; i++) {
+        std::string name = std::to_string(i) + ".pcd";
+        logger::replay(view_logs[i]);
+        clouds_map[name] = i;
+        stats_json["views"].push_back({{"view",   name},
+                                       {"stages", FilterPipeline::stats_to_json(view_stats[i])}});
+    }
+    // per stage totals over all views make pipelines easy to compare
+    for (std::size_t s = 0; num_views > 0 && s < view_stats[0].size(); s++) {
+        double wall_ms = 0;
+        std::size_t points_in = 0, points_out = 0, peak_rss = 0;
+        long long rss_delta = 0;
+        for (const auto &stats : view_stats) {
+            wall_ms += stats[s].wall_ms;
+            points_in += stats[s].points_in;
+            points_out += stats[s].points_out;
+            rss_delta += stats[s].rss_delta_bytes;
+            peak_rss = std::max(peak_rss, stats[s].process_peak_rss_bytes);
+        }
+        stats_json["totals"].push_back({{"stage",                  view_stats[0][s].stage},
+                                        {"wall_ms",                wall_ms},
+                                        {"points_in",              points_in},
+                                        {"points_out",             points_out},
+                                        {"rss_delta_bytes",        rss_delta},
+                                        {"process_peak_rss_bytes", peak_rss}});
     }
+    file_handler.update_pipeline_json(stats_json);
 }
 
 void model::ProcessingModel::transform_clouds_to_world() {
     if (clouds.empty()) {
         throw std::runtime_error("Cannot perform transformation, must load clouds first.");
     }
+    icp_engine.clear_views();
+    Eigen::Matrix4f transform = world_transform();
+    // the turntable and anything outside the scan volume is dropped while transforming, the grid stays
+    // organized for the filter pipeline
+    json config = file::IFileHandler::get_swag_scanner_config_json();
+    const transforms::CylinderCrop crop = FilterPipeline::scan_volume(config);
+    parallel::for_each_index(clouds.size(), [&](std::size_t i) {
+        std::size_t kept = transforms::transform_cloud_cropped(*clouds[i], *clouds[i], transform, crop);
+        LOG_DEBUG("cloud {}: {} points inside the scan volume", i, kept);
+    });
+}
+
+Eigen::Matrix4f model::ProcessingModel::world_transform() {
     json calibration_json = file_handler.get_calibration_json();
     std::vector<double> temp0 = calibration_json["axis_direction"].get<std::vector<double>>();
     equations::Normal rot_axis(temp0);
     auto temp = calibration_json["origin_point"].get<std::vector<double>>();
     pcl::PointXYZ center_pt(temp[0], temp[1], temp[2]);
-
-    for (auto &cloud: clouds) {
-        Eigen::Matrix4f transform = algos::calc_transform_to_world_matrix(center_pt, rot_axis);
-        pcl::transformPointCloud(*cloud, *cloud, transform);
-    }
+    return algos::calc_transform_to_world_matrix(center_pt, rot_axis);
 }
 
 void model::ProcessingModel::register_clouds() {
     json info_json = file_handler.get_info_json();
-    int angle = info_json["angle"];
+    float angle = info_json["angle"];
+    json config = file::IFileHandler::get_swag_scanner_config_json();
+    std::string method = config.value("registration_method", std::string("turntable"));
 
-    auto global_cloud = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
-    *global_cloud = *clouds[0];
-    pcl::PointCloud<pcl::PointXYZ> rotated;
-    for (int i = 1; i < clouds.size(); i++) {
-        rotated = algos::rotate_cloud_about_z_axis(clouds[i], angle * i);
-        *global_cloud += rotated;
+    std::vector<Eigen::Matrix4f> poses;
+    if (method == "pose_graph") {
+        poses = pose_graph_register(angle);
+    } else if (method == "turntable") {
+        for (int i = 0; i < clouds.size(); i++) {
+            poses.push_back(algos::z_rotation_matrix(angle * i));
+        }
+    } else {
+        throw std::invalid_argument("unknown registration_method in config.json: " + method);
     }
-    remove_outliers(global_cloud, 50, 1);
+
+    std::string merge_method = config.value("merge_method", std::string("concatenate"));
+    std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> global_cloud;
+    if (merge_method == "voxel") {
+        // overlapping views collapse per voxel and what too few views saw is dropped, no outlier pass needed
+        global_cloud = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>(
+                algos::merge_views_voxel_hash(clouds, poses, config.value("voxel_merge_leaf_size", .001f),
+                                              config.value("voxel_merge_min_views", 2)));
+    } else if (merge_method == "tsdf") {
+        // fusion averages overlapping views and drops what only one view saw, no outlier pass needed
+        global_cloud = fuse_views(poses, config);
+    } else if (merge_method == "concatenate") {
+        global_cloud = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>(
+                algos::merge_transformed_clouds(clouds, poses));
+        remove_outliers(global_cloud, 50, 1);
+    } else {
+        throw std::invalid_argument("unknown merge_method in config.json: " + merge_method);
+    }
+    // views come out one after the other, Morton order keeps neighbors close in the saved file too
+    algos::morton_sort(*global_cloud);
     add_cloud(global_cloud, "REGISTERED.pcd");
     save_cloud(global_cloud, "REGISTERED.pcd", CloudType::Type::REGISTERED);
 }
 
+std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>
+model::ProcessingModel::fuse_views(const std::vector<Eigen::Matrix4f> &poses, const json &config) {
+    auto start = std::chrono::steady_clock::now();
+    fusion::TSDFVolume volume(config.value("tsdf_voxel_size", .001f), config.value("tsdf_truncation", .004f));
+    // views are already in world coordinates, where the calibration put the camera origin
+    Eigen::Vector3f camera = world_transform().topRightCorner<3, 1>();
+    for (std::size_t i = 0; i < clouds.size(); i++) {
+        volume.integrate(*clouds[i], poses[i], camera);
+    }
+    auto surface = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>(
+            volume.extract_surface(config.value("tsdf_min_weight", 2.0f)));
+    double fuse_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    LOG_INFO("fused {} views into {} voxels and {} surface points ({} ms)",
+             clouds.size(), volume.size(), surface->size(), fuse_ms);
+    return surface;
+}
+
+std::vector<Eigen::Matrix4f> model::ProcessingModel::pose_graph_register(float angle) {
+    const std::size_t num_views = clouds.size();
+    std::vector<Eigen::Matrix4d> initial(num_views);
+    for (std::size_t i = 0; i < num_views; i++) {
+        initial[i] = algos::z_rotation_matrix(angle * i).cast<double>();
+    }
+
+    // neighbors, plus last -> first if the views go all the way around the turntable
+    std::vector<std::pair<std::size_t, std::size_t>> pairs;
+    for (std::size_t i = 0; i + 1 < num_views; i++) {
+        pairs.emplace_back(i, i + 1);
+    }
+    float gap = 360 - angle * (num_views - 1);
+    if (num_views > 2 && gap > 0 && gap <= 1.5 * angle) {
+        pairs.emplace_back(num_views - 1, 0);
+    }
+
+    index_views();
+    std::vector<registration::ICPResult> results(pairs.size());
+    parallel::for_each_index(pairs.size(), [&](std::size_t k) {
+        const auto &pair = pairs[k];
+        Eigen::Matrix4f guess = (initial[pair.second].inverse() * initial[pair.first]).cast<float>();
+        results[k] = icp_engine.align_views(pair.first, pair.second, guess);
+    });
+
+    registration::PoseGraph graph(initial);
+    json registration_json = {{"method",       "pose_graph"},
+                              {"angle",        angle},
+                              {"loop_closure", pairs.size() == num_views},
+                              {"edges",        json::array()}};
+    for (std::size_t k = 0; k < pairs.size(); k++) {
+        const auto &pair = pairs[k];
+        Eigen::Matrix4d measurement = results[k].transform.cast<double>();
+        Eigen::Matrix<double, 6, 6> information = Eigen::Matrix<double, 6, 6>::Identity();
+        if (!results[k].stats.converged) {
+            // fall back to the turntable for this pair and let the other edges decide
+            LOG_ERROR("ICP between views {} and {} did not converge ({}), using the turntable angle",
+                      pair.first, pair.second, results[k].stats.stop_reason);
+            measurement = initial[pair.second].inverse() * initial[pair.first];
+            information *= 1e-3;
+        }
+        graph.add_edge(pair.first, pair.second, measurement, information);
+        registration_json["edges"].push_back({{"from", pair.first},
+                                              {"to",   pair.second},
+                                              {"icp",  registration::ICPEngine::stats_to_json(results[k].stats)}});
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    double initial_error = graph.total_error();
+    int iterations = graph.optimize();
+    double solve_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    LOG_INFO("pose graph optimized {} views in {} iterations ({} ms), error {} -> {}",
+             num_views, iterations, solve_ms, initial_error, graph.total_error());
+    registration_json["optimization"] = {{"iterations",    iterations},
+                                         {"solve_ms",      solve_ms},
+                                         {"initial_error", initial_error},
+                                         {"final_error",   graph.total_error()}};
+    file_handler.update_registration_json(registration_json);
+
+    std::vector<Eigen::Matrix4f> poses;
+    for (const auto &pose : graph.get_poses()) {
+        poses.push_back(pose.cast<float>());
+    }
+    return poses;
+}
+
 Eigen::Matrix4f
 model::ProcessingModel::icp_register_pair_clouds(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud_src,
                                                  const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud_target,
-                                                 std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &transformed_cloud) {
-    pcl::IterativeClosestPoint<pcl::PointXYZ, pcl::PointXYZ> icp;
-    icp.setInputSource(cloud_src);
-    icp.setInputTarget(cloud_target);
-    icp.setMaximumIterations(100);
-    icp.setTransformationEpsilon(1e-10);
-    icp.setMaxCorrespondenceDistance(.05); // not really sure how this affects results
-    icp.setEuclideanFitnessEpsilon(.0001); // big effect
-    icp.setRANSACOutlierRejectionThreshold(.0001); // doesn't seem to affect results much
+                                                 std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &transformed_cloud,
+                                                 const Eigen::Matrix4f &guess) {
     logger::info("ICP registering clouds...");
-    icp.align(*transformed_cloud);
-    if (icp.hasConverged()) {
-        logger::info("ICP has converged, score is: " + std::to_string(icp.getFitnessScore()));
-        auto trans = icp.getFinalTransformation().cast<double>();
+    // index the loaded views once, every later pair that involves them reuses their trees and proxies
+    if (std::find(clouds.begin(), clouds.end(), cloud_src) != clouds.end() ||
+        std::find(clouds.begin(), clouds.end(), cloud_target) != clouds.end()) {
+        index_views();
+    }
+    const registration::ViewPyramid *src = icp_engine.find_pyramid(cloud_src);
+    const registration::ViewPyramid *target = icp_engine.find_pyramid(cloud_target);
+    registration::ViewPyramid temp_src, temp_target;
+    double build_ms = 0;
+    // normals from the filter pipeline if the cloud is one of ours
+    auto normals_of = [this](const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud) {
+        for (std::size_t i = 0; i < clouds.size() && i < view_normals.size(); i++) {
+            if (clouds[i] == cloud) {
+                return view_normals[i];
+            }
+        }
+        return std::shared_ptr<pcl::PointCloud<pcl::Normal>>();
+    };
+    if (src == nullptr) {
+        temp_src = icp_engine.build_pyramid(cloud_src, normals_of(cloud_src));
+        src = &temp_src;
+    }
+    if (target == nullptr) {
+        temp_target = icp_engine.build_pyramid(cloud_target, normals_of(cloud_target));
+        for (const auto &level : temp_target.levels) {
+            build_ms += level->get_build_ms();
+        }
+        target = &temp_target;
+    }
+    registration::ICPResult result = icp_engine.align_pyramid(*src, *target, guess);
+    result.stats.index_build_ms = build_ms;
+
+    if (transformed_cloud == nullptr) {
+        transformed_cloud = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    }
+    transforms::transform_cloud(*cloud_src, *transformed_cloud, result.transform);
+    if (result.stats.converged) {
+        LOG_INFO("ICP has converged after {} iterations (per level: {}, {}), score is: {}",
+                 result.stats.iterations, json(result.stats.level_iterations).dump(), result.stats.stop_reason,
+                 result.stats.fitness);
         std::stringstream ss;
-        ss << trans;
+        ss << result.transform.cast<double>();
         logger::info(ss.str());
     } else {
-        PCL_ERROR ("\nICP has not converged.\n");
+        LOG_ERROR("ICP has not converged ({}), score is: {}", result.stats.stop_reason, result.stats.fitness);
     }
-    return icp.getFinalTransformation();
+    LOG_DEBUG("ICP timings: {}", registration::ICPEngine::stats_to_json(result.stats).dump());
+    return result.transform;
 }
 
+void model::ProcessingModel::index_views() {
+    for (const auto &cloud : clouds) {
+        if (icp_engine.find_pyramid(cloud) == nullptr) {
+            icp_engine.set_views(clouds, view_normals);
+            return;
+        }
+    }
+}
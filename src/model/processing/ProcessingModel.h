@@ -3,6 +3,7 @@
 
 #include "IModel.h"
 #include "ScanFileHandler.h"
+#include "ICPEngine.h"
 
 namespace spdlog {
     class logger;
@@ -40,33 +41,38 @@ namespace model {
 
 
         /**
-         * Use ICP registration between two clouds.
+         * Use ICP registration between two clouds. Loaded views are indexed once by the registration engine and
+         * their search trees and proxies are reused by every later pair, other clouds get temporary ones.
+         * "registration_icp" in settings/config.json picks "point_to_point" (default, the settings of the old
+         * PCL ICP with a 0.05 correspondence distance) or "point_to_plane" (uses the normals the filter pipeline
+         * computed on the organized grid).
+         * With "registration_pyramid" in settings/config.json (voxel sizes, e.g. [0.004, 0.002, 0.001], empty by
+         * default) ICP runs coarse to fine on downsampled proxies and only does "registration_full_iterations" on
+         * the full clouds.
          *
          * @param cloud_src cloud source.
          * @param cloud_target cloud target.
          * @param transformed_cloud copy of source -> target.
+         * @param guess initial source -> target transform, e.g. algos::z_rotation_matrix for neighboring views.
          * @return matrix transformation of source -> target.
          */
         Eigen::Matrix4f icp_register_pair_clouds(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud_src,
                                                  const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud_target,
-                                                 std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &transformed_cloud);
+                                                 std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &transformed_cloud,
+                                                 const Eigen::Matrix4f &guess = Eigen::Matrix4f::Identity());
 
         /**
-         *  Do cropping, Run bilateral filter, Remove NaN points, remove outliers.
-         *
-         * @param sigma_s filter window for bilateral filter.
-         * @param sigma_r standard deviation of the gaussian for bilateral filter.
-         * @param mean_k number of neighbors to analyze.
-         * @param thresh_mult multipler for standard deviation, members outside st will be removed.
+         * Run the scan filter pipeline on every view and save the filtered clouds.
+         * The pipeline is read from "scan_filter_pipeline" in settings/config.json (defaults to cropping,
+         * bilateral filter, NaN removal and outlier removal). Views are filtered and saved in parallel, names
+         * and logs are written in view order afterwards. Per stage timings go to info/pipeline.json.
          */
-        void filter(int sigma_s = 10,
-                    float sigma_r = .01,
-                    int mean_k = 50,
-                    float thresh_mult = 1);
+        void filter();
 
         /**
          * Transform clouds to world coordinate.
-         * Loads the latest calibration for data used in transformation.
+         * Loads the latest calibration for data used in transformation. Points outside "scan_volume" in
+         * config.json become NaN on the way, see FilterPipeline::scan_volume.
          * TODO: modify this so processModel can accept any calibration instead of just the latest.
          *
          * @throws runtime_error if the clouds vector is not loaded yet.
@@ -74,7 +80,16 @@ namespace model {
         void transform_clouds_to_world();
 
         /**
-         * Perform registration on clouds. Rotates them by scanning angle to original cloud.
+         * Perform registration on clouds and merge them into REGISTERED.pcd.
+         * "registration_method" in settings/config.json picks how views are placed:
+         * "turntable" rotates them by the scanning angle, "pose_graph" aligns neighboring views with ICP
+         * (closing the loop between the last and first view on a full turn) and optimizes a pose graph.
+         * "merge_method" picks how the placed views become one cloud: "concatenate" (the default) stacks them
+         * and removes outliers, "voxel" averages them per voxel ("voxel_merge_leaf_size") and drops voxels
+         * fewer than "voxel_merge_min_views" views saw, "tsdf" fuses them into a truncated signed distance
+         * volume ("tsdf_voxel_size", "tsdf_truncation", "tsdf_min_weight") and keeps the zero crossings, so
+         * the output stays bounded. "voxel" and "tsdf" smooth at their leaf size, so they are opt-in.
+         * The merged cloud is saved in Morton order, see algos::MortonOctree for range and LOD queries on it.
          */
         void register_clouds();
 
@@ -82,6 +97,42 @@ namespace model {
     private:
         std::shared_ptr<spdlog::logger> logger;
         file::ScanFileHandler file_handler;
+        registration::ICPEngine icp_engine;
+
+        /**
+         * Normals of each view from the filter pipeline's organized_normals stage, nullptr if there were none.
+         */
+        std::vector<std::shared_ptr<pcl::PointCloud<pcl::Normal>>> view_normals;
+
+        /**
+         * Build the search indices of every loaded view in icp_engine, unless it already holds all of them.
+         * Anything that changes the views drops the indices with icp_engine.clear_views().
+         */
+        void index_views();
+
+        /**
+         * ICP every neighboring pair of views in parallel using the turntable angle as the initial guess,
+         * then spread the drift with a pose graph. Writes the edges and solver stats to info/registration.json.
+         *
+         * @param angle degrees between views.
+         * @return pose of every view in the frame of view 0.
+         */
+        std::vector<Eigen::Matrix4f> pose_graph_register(float angle);
+
+        /**
+         * Transform from camera to world coordinates from the latest calibration.
+         */
+        Eigen::Matrix4f world_transform();
+
+        /**
+         * Integrate every view at its pose into a TSDF volume and extract the surface.
+         *
+         * @param poses pose of every view.
+         * @param config swag scanner config with the tsdf settings.
+         * @return fused surface cloud.
+         */
+        std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> fuse_views(const std::vector<Eigen::Matrix4f> &poses,
+                                                                   const nlohmann::json &config);
 
     };
 }
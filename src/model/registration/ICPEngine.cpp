@@ -0,0 +1,475 @@
+#include "ICPEngine.h"
+#include "Parallel.h"
+#include "Algorithms.h"
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+using json = nlohmann::json;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double ms_since(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    using Vector6d = Eigen::Matrix<double, 6, 1>;
+    using Matrix6d = Eigen::Matrix<double, 6, 6>;
+
+    /**
+     * Sums over one chunk of correspondences, enough to get centroids and the cross covariance for point to
+     * point, and the normal equations of the linearized point to plane error.
+     */
+    struct Moments {
+        Eigen::Vector3d sum_src = Eigen::Vector3d::Zero();
+        Eigen::Vector3d sum_tgt = Eigen::Vector3d::Zero();
+        Eigen::Matrix3d sum_src_tgt = Eigen::Matrix3d::Zero();
+        double sum_sq_dist = 0;
+        std::size_t count = 0;
+
+        Matrix6d plane_ata = Matrix6d::Zero();
+        Vector6d plane_atb = Vector6d::Zero();
+        std::size_t plane_count = 0;
+
+        void add(const Moments &other) {
+            sum_src += other.sum_src;
+            sum_tgt += other.sum_tgt;
+            sum_src_tgt += other.sum_src_tgt;
+            sum_sq_dist += other.sum_sq_dist;
+            count += other.count;
+            plane_ata += other.plane_ata;
+            plane_atb += other.plane_atb;
+            plane_count += other.plane_count;
+        }
+    };
+
+    const std::size_t grain = 4096;
+
+    /**
+     * Transform every source point, find its closest target point and sum up the pairs that are closer than
+     * max_sq_dist. Chunks are reduced in order so the sums are the same on any number of threads.
+     * Point to plane sums are only collected when target normals are given.
+     */
+    Moments find_correspondences(const pcl::PointCloud<pcl::PointXYZ> &src,
+                                 const registration::SearchIndex &target,
+                                 const Eigen::Matrix4f &transform,
+                                 double max_sq_dist,
+                                 const pcl::PointCloud<pcl::Normal> *target_normals = nullptr) {
+        const std::size_t n = src.points.size();
+        const auto &target_points = target.get_cloud()->points;
+        std::vector<Moments> chunks(parallel::num_chunks(n, grain));
+        parallel::for_each_range(n, grain, [&](std::size_t begin, std::size_t end) {
+            Moments &m = chunks[begin / grain];
+            std::vector<int> idx_buf(1);
+            std::vector<float> dist_buf(1);
+            const Eigen::Matrix3f rot = transform.topLeftCorner<3, 3>();
+            const Eigen::Vector3f trans = transform.topRightCorner<3, 1>();
+            for (std::size_t i = begin; i < end; i++) {
+                const pcl::PointXYZ &p = src.points[i];
+                if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) {
+                    continue;
+                }
+                Eigen::Vector3f moved = rot * p.getVector3fMap() + trans;
+                pcl::PointXYZ query(moved.x(), moved.y(), moved.z());
+                int index;
+                float sq_dist;
+                if (!target.nearest(query, index, sq_dist, idx_buf, dist_buf) || sq_dist > max_sq_dist) {
+                    continue;
+                }
+                Eigen::Vector3d s = moved.cast<double>();
+                Eigen::Vector3d t = target_points[index].getVector3fMap().cast<double>();
+                m.sum_src += s;
+                m.sum_tgt += t;
+                m.sum_src_tgt += s * t.transpose();
+                m.sum_sq_dist += sq_dist;
+                m.count++;
+
+                if (target_normals != nullptr) {
+                    const pcl::Normal &normal = target_normals->points[index];
+                    if (!std::isfinite(normal.normal_x)) {
+                        continue;
+                    }
+                    Eigen::Vector3d n = normal.getNormalVector3fMap().cast<double>();
+                    // residual n.(s - t), derivative wrt (small rotation w, translation) is (s x n, n)
+                    Vector6d row;
+                    row.head<3>() = s.cross(n);
+                    row.tail<3>() = n;
+                    m.plane_ata.selfadjointView<Eigen::Upper>().rankUpdate(row);
+                    m.plane_atb += row * n.dot(s - t);
+                    m.plane_count++;
+                }
+            }
+        });
+        Moments total;
+        for (const auto &m : chunks) {
+            total.add(m);
+        }
+        return total;
+    }
+
+    /**
+     * Least squares rigid transform taking the source points onto their correspondences (Kabsch / Umeyama
+     * without scale).
+     */
+    Eigen::Matrix4f estimate_rigid_transform(const Moments &m) {
+        const double n = double(m.count);
+        Eigen::Vector3d mean_src = m.sum_src / n;
+        Eigen::Vector3d mean_tgt = m.sum_tgt / n;
+        Eigen::Matrix3d cov = m.sum_src_tgt / n - mean_src * mean_tgt.transpose();
+
+        Eigen::JacobiSVD<Eigen::Matrix3d> svd(cov, Eigen::ComputeFullU | Eigen::ComputeFullV);
+        Eigen::Matrix3d v = svd.matrixV();
+        if ((v * svd.matrixU().transpose()).determinant() < 0) {
+            v.col(2) *= -1; // reflection, flip the axis with the smallest singular value
+        }
+        Eigen::Matrix3d rot = v * svd.matrixU().transpose();
+
+        Eigen::Matrix4d transform = Eigen::Matrix4d::Identity();
+        transform.topLeftCorner<3, 3>() = rot;
+        transform.topRightCorner<3, 1>() = mean_tgt - rot * mean_src;
+        return transform.cast<float>();
+    }
+
+    /**
+     * Gauss-Newton step of the point to plane error, rotation kept exact through the angle axis.
+     * Returns false if the normals don't constrain all six degrees of freedom (e.g. one flat plane).
+     */
+    bool estimate_plane_transform(const Moments &m, Eigen::Matrix4f &transform) {
+        Matrix6d ata = m.plane_ata.selfadjointView<Eigen::Upper>();
+        Eigen::LDLT<Matrix6d> ldlt(ata);
+        if (ldlt.info() != Eigen::Success || ldlt.vectorD().minCoeff() <= 1e-12 * ldlt.vectorD().maxCoeff()) {
+            return false;
+        }
+        Vector6d x = ldlt.solve(-m.plane_atb);
+        Eigen::Vector3d w = x.head<3>();
+        Eigen::Matrix4d delta = Eigen::Matrix4d::Identity();
+        if (w.norm() > 0) {
+            delta.topLeftCorner<3, 3>() = Eigen::AngleAxisd(w.norm(), w.normalized()).toRotationMatrix();
+        }
+        delta.topRightCorner<3, 1>() = x.tail<3>();
+        transform = delta.cast<float>();
+        return true;
+    }
+
+    /**
+     * Normals from the k nearest neighbors, direction of least variance. Fallback for clouds that didn't come
+     * with organized normals, like pyramid proxies.
+     */
+    std::shared_ptr<pcl::PointCloud<pcl::Normal>> estimate_neighbor_normals(const registration::SearchIndex &index,
+                                                                            int k) {
+        const auto &points = index.get_cloud()->points;
+        auto normals = std::make_shared<pcl::PointCloud<pcl::Normal>>();
+        normals->points.resize(points.size());
+        normals->width = points.size();
+        normals->height = 1;
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        parallel::for_each_range(points.size(), grain, [&](std::size_t begin, std::size_t end) {
+            std::vector<int> idx;
+            std::vector<float> dist;
+            for (std::size_t i = begin; i < end; i++) {
+                pcl::Normal &n = normals->points[i];
+                n.normal_x = n.normal_y = n.normal_z = n.curvature = nan;
+                const pcl::PointXYZ &p = points[i];
+                if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z) ||
+                    index.nearest_k(p, k, idx, dist) < 3) {
+                    continue;
+                }
+                Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+                for (int j : idx) {
+                    mean += points[j].getVector3fMap().cast<double>();
+                }
+                mean /= double(idx.size());
+                Eigen::Matrix3d cov = Eigen::Matrix3d::Zero();
+                for (int j : idx) {
+                    Eigen::Vector3d d = points[j].getVector3fMap().cast<double>() - mean;
+                    cov += d * d.transpose();
+                }
+                Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(cov);
+                Eigen::Vector3f normal = solver.eigenvectors().col(0).cast<float>();
+                n.normal_x = normal.x();
+                n.normal_y = normal.y();
+                n.normal_z = normal.z();
+                n.curvature = float(solver.eigenvalues()[0] / std::max(solver.eigenvalues().sum(), 1e-30));
+            }
+        });
+        return normals;
+    }
+}
+
+registration::SearchIndex::SearchIndex(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                                       const std::shared_ptr<pcl::PointCloud<pcl::Normal>> &normals) :
+        cloud(cloud), normals(normals), tree(false) {
+    if (normals != nullptr && normals->points.size() != cloud->points.size()) {
+        throw std::invalid_argument("normals don't match the cloud point for point");
+    }
+    auto start = Clock::now();
+    tree.setInputCloud(cloud);
+    build_ms = ms_since(start);
+}
+
+int registration::SearchIndex::nearest_k(const pcl::PointXYZ &pt, int k,
+                                         std::vector<int> &indices, std::vector<float> &sq_dists) const {
+    return tree.nearestKSearch(pt, k, indices, sq_dists);
+}
+
+const std::shared_ptr<pcl::PointCloud<pcl::Normal>> &registration::SearchIndex::get_normals() const {
+    return normals;
+}
+
+void registration::SearchIndex::estimate_normals(int k) {
+    normals = estimate_neighbor_normals(*this, k);
+}
+
+bool registration::SearchIndex::nearest(const pcl::PointXYZ &pt, int &index, float &sq_dist,
+                                        std::vector<int> &idx_buf, std::vector<float> &dist_buf) const {
+    if (tree.nearestKSearch(pt, 1, idx_buf, dist_buf) < 1) {
+        return false;
+    }
+    index = idx_buf[0];
+    sq_dist = dist_buf[0];
+    return true;
+}
+
+const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &registration::SearchIndex::get_cloud() const {
+    return cloud;
+}
+
+double registration::SearchIndex::get_build_ms() const {
+    return build_ms;
+}
+
+registration::ICPEngine::ICPEngine(ICPParams params) : params(params) {}
+
+void registration::ICPEngine::set_views(const std::vector<std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>> &clouds,
+                                        const std::vector<std::shared_ptr<pcl::PointCloud<pcl::Normal>>> &normals) {
+    views.clear();
+    views.resize(clouds.size());
+    parallel::for_each_index(clouds.size(), [&](std::size_t i) {
+        views[i] = build_pyramid(clouds[i], i < normals.size() ? normals[i] : nullptr);
+    });
+}
+
+void registration::ICPEngine::clear_views() {
+    views.clear();
+}
+
+std::size_t registration::ICPEngine::num_views() const {
+    return views.size();
+}
+
+const registration::SearchIndex &registration::ICPEngine::get_index(std::size_t view) const {
+    if (view >= views.size()) {
+        throw std::out_of_range("no search index for view " + std::to_string(view));
+    }
+    return views[view].full();
+}
+
+const registration::SearchIndex *
+registration::ICPEngine::find_index(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud) const {
+    const ViewPyramid *pyramid = find_pyramid(cloud);
+    return pyramid != nullptr ? &pyramid->full() : nullptr;
+}
+
+const registration::ViewPyramid *
+registration::ICPEngine::find_pyramid(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud) const {
+    for (const auto &view : views) {
+        if (view.full().get_cloud() == cloud) {
+            return &view;
+        }
+    }
+    return nullptr;
+}
+
+registration::ViewPyramid
+registration::ICPEngine::build_pyramid(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                                       const std::shared_ptr<pcl::PointCloud<pcl::Normal>> &normals) const {
+    const bool plane = params.method == ICPMethod::POINT_TO_PLANE;
+    ViewPyramid pyramid;
+    for (float leaf_size : params.pyramid_leaf_sizes) {
+        auto proxy = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>(algos::voxel_hash_downsample(cloud, leaf_size));
+        pyramid.levels.push_back(std::make_unique<SearchIndex>(proxy));
+        if (plane) {
+            pyramid.levels.back()->estimate_normals(params.normal_neighbors);
+        }
+    }
+    pyramid.levels.push_back(std::make_unique<SearchIndex>(cloud, normals));
+    if (plane && normals == nullptr) {
+        pyramid.levels.back()->estimate_normals(params.normal_neighbors);
+    }
+    return pyramid;
+}
+
+registration::ICPResult registration::ICPEngine::align(const pcl::PointCloud<pcl::PointXYZ> &src,
+                                                       const SearchIndex &target,
+                                                       const Eigen::Matrix4f &guess) const {
+    ICPResult result = align_level(src, target, guess, params.max_iterations, params.max_correspondence_distance,
+                                   true);
+    result.stats.level_iterations.push_back(result.stats.iterations);
+    return result;
+}
+
+registration::ICPResult registration::ICPEngine::align_pyramid(const ViewPyramid &src, const ViewPyramid &target,
+                                                               const Eigen::Matrix4f &guess) const {
+    if (src.levels.size() != target.levels.size()) {
+        throw std::invalid_argument("source and target pyramids have a different number of levels");
+    }
+    if (src.levels.size() == 1) {
+        return align(*src.full().get_cloud(), target.full(), guess);
+    }
+
+    auto start = Clock::now();
+    ICPResult result;
+    result.transform = guess;
+    const std::size_t num_proxies = src.levels.size() - 1;
+    bool proxies_converged = false;
+    for (std::size_t l = 0; l < src.levels.size(); l++) {
+        bool full = l == num_proxies;
+        // coarse levels can't match closer than a voxel, so don't reject pairs that are just a voxel apart
+        double max_distance = full ? params.max_correspondence_distance
+                                   : std::max(params.max_correspondence_distance,
+                                              2.0 * params.pyramid_leaf_sizes[l]);
+        ICPResult level = align_level(*src.levels[l]->get_cloud(), *target.levels[l], result.transform,
+                                      full ? params.full_resolution_iterations : params.max_iterations,
+                                      max_distance, full);
+        if (l + 1 == num_proxies) {
+            proxies_converged = level.stats.converged;
+        }
+        result.transform = level.transform;
+        ICPStats &stats = result.stats;
+        stats.iterations += level.stats.iterations;
+        stats.level_iterations.push_back(level.stats.iterations);
+        stats.iteration_ms.insert(stats.iteration_ms.end(), level.stats.iteration_ms.begin(),
+                                  level.stats.iteration_ms.end());
+        stats.search_ms.insert(stats.search_ms.end(), level.stats.search_ms.begin(), level.stats.search_ms.end());
+        stats.iteration_correspondences.insert(stats.iteration_correspondences.end(),
+                                               level.stats.iteration_correspondences.begin(),
+                                               level.stats.iteration_correspondences.end());
+        if (full) {
+            // the full resolution level decides, running out of its iterations is reported as not converged
+            stats.converged = level.stats.converged;
+            stats.proxies_converged = proxies_converged;
+            stats.stop_reason = level.stats.stop_reason;
+            stats.fitness = level.stats.fitness;
+            stats.correspondences = level.stats.correspondences;
+            stats.inliers = level.stats.inliers;
+            stats.inlier_rmse = level.stats.inlier_rmse;
+            stats.overlap = level.stats.overlap;
+        }
+    }
+    result.stats.total_ms = ms_since(start);
+    return result;
+}
+
+registration::ICPResult registration::ICPEngine::align_level(const pcl::PointCloud<pcl::PointXYZ> &src,
+                                                             const SearchIndex &target,
+                                                             const Eigen::Matrix4f &guess,
+                                                             int max_iterations,
+                                                             double max_distance,
+                                                             bool score) const {
+    // same defaults as pcl::DefaultConvergenceCriteria
+    const double rotation_threshold = 0.99999;
+    const double relative_mse_threshold = 1e-5;
+
+    auto start = Clock::now();
+    ICPResult result;
+    result.transform = guess;
+    const double max_sq_dist = max_distance * max_distance;
+    double prev_mse = std::numeric_limits<double>::max();
+    result.stats.stop_reason = "max_iterations";
+
+    const pcl::PointCloud<pcl::Normal> *target_normals =
+            params.method == ICPMethod::POINT_TO_PLANE ? target.get_normals().get() : nullptr;
+
+    for (int it = 0; it < max_iterations; it++) {
+        auto iteration_start = Clock::now();
+        Moments m = find_correspondences(src, target, result.transform, max_sq_dist, target_normals);
+        result.stats.search_ms.push_back(ms_since(iteration_start));
+        result.stats.iteration_correspondences.push_back(m.count);
+        result.stats.iterations++;
+        if (m.count < 3) {
+            result.stats.stop_reason = "too_few_correspondences";
+            result.stats.iteration_ms.push_back(ms_since(iteration_start));
+            break;
+        }
+
+        Eigen::Matrix4f delta;
+        // point to plane when there are enough normals to pin down all six degrees of freedom
+        if (target_normals == nullptr || m.plane_count < 6 || !estimate_plane_transform(m, delta)) {
+            delta = estimate_rigid_transform(m);
+        }
+        result.transform = delta * result.transform;
+        result.stats.iteration_ms.push_back(ms_since(iteration_start));
+
+        double cos_angle = 0.5 * (delta.topLeftCorner<3, 3>().trace() - 1);
+        double translation_sq = delta.topRightCorner<3, 1>().squaredNorm();
+        if (cos_angle >= rotation_threshold && translation_sq <= params.transformation_epsilon) {
+            result.stats.converged = true;
+            result.stats.stop_reason = "transformation_epsilon";
+            break;
+        }
+        double mse = m.sum_sq_dist / double(m.count);
+        if (std::abs(mse - prev_mse) < params.euclidean_fitness_epsilon ||
+            std::abs(mse - prev_mse) / prev_mse < relative_mse_threshold) {
+            result.stats.converged = true;
+            result.stats.stop_reason = "fitness_epsilon";
+            break;
+        }
+        prev_mse = mse;
+    }
+
+    if (score) {
+        // score like pcl's getFitnessScore: every source point counts, not just the close ones
+        Moments final_pairs = find_correspondences(src, target, result.transform,
+                                                   std::numeric_limits<double>::max());
+        result.stats.correspondences = final_pairs.count;
+        result.stats.fitness = final_pairs.count > 0 ? final_pairs.sum_sq_dist / double(final_pairs.count)
+                                                     : std::numeric_limits<double>::max();
+        // the part of a view the target never saw is far away by nature, judge the match on the overlap
+        Moments inliers = find_correspondences(src, target, result.transform, max_sq_dist);
+        result.stats.inliers = inliers.count;
+        result.stats.inlier_rmse = inliers.count > 0 ? std::sqrt(inliers.sum_sq_dist / double(inliers.count))
+                                                     : std::numeric_limits<double>::max();
+        result.stats.overlap = final_pairs.count > 0 ? double(inliers.count) / double(final_pairs.count) : 0;
+    }
+    result.stats.total_ms = ms_since(start);
+    return result;
+}
+
+registration::ICPResult registration::ICPEngine::align_views(std::size_t src, std::size_t target,
+                                                             const Eigen::Matrix4f &guess) const {
+    if (src >= views.size() || target >= views.size()) {
+        throw std::out_of_range("no search index for view " + std::to_string(std::max(src, target)));
+    }
+    return align_pyramid(views[src], views[target], guess);
+}
+
+const registration::ICPParams &registration::ICPEngine::get_params() const {
+    return params;
+}
+
+void registration::ICPEngine::set_params(const ICPParams &params) {
+    this->params = params;
+}
+
+json registration::ICPEngine::stats_to_json(const ICPStats &stats) {
+    return {{"iterations",                stats.iterations},
+            {"converged",                 stats.converged},
+            {"proxies_converged",         stats.proxies_converged},
+            {"stop_reason",               stats.stop_reason},
+            {"fitness",                   stats.fitness},
+            {"correspondences",           stats.correspondences},
+            {"inliers",                   stats.inliers},
+            {"inlier_rmse",               stats.inlier_rmse},
+            {"overlap",                   stats.overlap},
+            {"index_build_ms",            stats.index_build_ms},
+            {"total_ms",                  stats.total_ms},
+            {"iteration_ms",              stats.iteration_ms},
+            {"search_ms",                 stats.search_ms},
+            {"iteration_correspondences", stats.iteration_correspondences},
+            {"level_iterations",          stats.level_iterations}};
+}
@@ -0,0 +1,239 @@
+#ifndef SWAG_SCANNER_ICPENGINE_H
+#define SWAG_SCANNER_ICPENGINE_H
+
+#include <Eigen/Core>
+#include <memory>
+#include <string>
+#include <vector>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/search/kdtree.h>
+#include <nlohmann/json.hpp>
+
+/**
+ * Registration of scan views. Everything here only reads the clouds it's given, so pairs of views can be
+ * aligned concurrently.
+ */
+namespace registration {
+
+    /**
+     * Nearest neighbor index over one view. Built once and shared by every pair that uses the view as target.
+     * Queries are const and safe from many threads.
+     */
+    class SearchIndex {
+    public:
+        /**
+         * @param cloud cloud to index.
+         * @param normals optional normals of the cloud, needed for point to plane ICP.
+         * @throws invalid_argument if the normals don't match the cloud in size.
+         */
+        explicit SearchIndex(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                             const std::shared_ptr<pcl::PointCloud<pcl::Normal>> &normals = nullptr);
+
+        /**
+         * Find the closest point in the indexed cloud.
+         *
+         * @param pt query point.
+         * @param index index of the closest point.
+         * @param sq_dist squared distance to the closest point.
+         * @return false if the cloud has no points.
+         */
+        bool nearest(const pcl::PointXYZ &pt, int &index, float &sq_dist,
+                     std::vector<int> &idx_buf, std::vector<float> &dist_buf) const;
+
+        /**
+         * k nearest neighbors of a point.
+         *
+         * @return number of neighbors found.
+         */
+        int nearest_k(const pcl::PointXYZ &pt, int k, std::vector<int> &indices, std::vector<float> &sq_dists) const;
+
+        const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &get_cloud() const;
+
+        const std::shared_ptr<pcl::PointCloud<pcl::Normal>> &get_normals() const;
+
+        /**
+         * Compute normals from the k nearest neighbors with the tree. Slower and noisier than normals from
+         * the organized grid, used when a cloud has none.
+         */
+        void estimate_normals(int k);
+
+        /**
+         * @return milliseconds it took to build the tree.
+         */
+        double get_build_ms() const;
+
+    private:
+        std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> cloud;
+        std::shared_ptr<pcl::PointCloud<pcl::Normal>> normals;
+        pcl::search::KdTree<pcl::PointXYZ> tree;
+        double build_ms = 0;
+    };
+
+    /**
+     * Error ICP minimizes. Point to plane lets points slide along the surface and usually needs a fraction of
+     * the iterations on smooth objects, but needs target normals.
+     */
+    enum class ICPMethod {
+        POINT_TO_POINT,
+        POINT_TO_PLANE
+    };
+
+    /**
+     * Settings for ICP, same meaning as the pcl::IterativeClosestPoint setters.
+     */
+    struct ICPParams {
+        ICPMethod method = ICPMethod::POINT_TO_POINT;
+
+        /**
+         * Neighbors used for normals when a target has no normals of its own.
+         */
+        int normal_neighbors = 10;
+
+        int max_iterations = 100;
+        double max_correspondence_distance = .05;
+        double transformation_epsilon = 1e-10;
+        double euclidean_fitness_epsilon = .0001;
+
+        /**
+         * Voxel sizes of the coarse to fine proxies, e.g. {.004, .002, .001}. Each level runs up to
+         * max_iterations starting where the previous one stopped. Empty (the default) means plain full
+         * resolution ICP.
+         */
+        std::vector<float> pyramid_leaf_sizes;
+
+        /**
+         * Iterations allowed at full resolution after the pyramid, the proxies already did the heavy lifting.
+         */
+        int full_resolution_iterations = 5;
+    };
+
+    /**
+     * Where the time went and why ICP stopped.
+     */
+    struct ICPStats {
+        int iterations = 0;
+        bool converged = false;
+        bool proxies_converged = false;          /** the last proxy level of a pyramid converged, converged can
+                                                     still be false if the full level ran out of iterations */
+        std::string stop_reason;                 /** "transformation_epsilon", "fitness_epsilon", "max_iterations"
+                                                     or "too_few_correspondences" */
+        double fitness = 0;                      /** mean squared nearest neighbor distance, like getFitnessScore */
+        std::size_t correspondences = 0;         /** finite source points that went into the fitness */
+        std::size_t inliers = 0;                 /** source points within max_correspondence_distance */
+        double inlier_rmse = 0;                  /** RMS distance of the inliers, meters */
+        double overlap = 0;                      /** inliers / correspondences */
+        double index_build_ms = 0;               /** 0 when the target index was cached */
+        double total_ms = 0;
+        std::vector<double> iteration_ms;
+        std::vector<double> search_ms;           /** correspondence search part of each iteration */
+        std::vector<std::size_t> iteration_correspondences;
+        std::vector<int> level_iterations;       /** iterations per pyramid level, full resolution last */
+    };
+
+    struct ICPResult {
+        Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+        ICPStats stats;
+    };
+
+    /**
+     * A view and its downsampled proxies, coarsest first. The last level is the full resolution cloud.
+     */
+    struct ViewPyramid {
+        std::vector<std::unique_ptr<SearchIndex>> levels;
+
+        const SearchIndex &full() const {
+            return *levels.back();
+        }
+    };
+
+    /**
+     * Point to point or point to plane ICP with cached target indices and a parallel correspondence search.
+     * Each iteration splits the source into fixed chunks, searches them on the default thread pool and adds
+     * up the per chunk sums in chunk order, so the result does not depend on the number of threads.
+     */
+    class ICPEngine {
+    public:
+        explicit ICPEngine(ICPParams params = ICPParams());
+
+        /**
+         * Build search indices for every view (and its pyramid levels) in parallel. Replaces indices from a
+         * previous call.
+         * Views must not be modified while the engine holds them.
+         *
+         * @param views clouds, the index of a view is its position in this vector.
+         * @param normals optional normals per view (e.g. from the organized grid). Point to plane estimates
+         * them from neighbors for views without.
+         */
+        void set_views(const std::vector<std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>> &views,
+                       const std::vector<std::shared_ptr<pcl::PointCloud<pcl::Normal>>> &normals = {});
+
+        /**
+         * Drop every cached index.
+         */
+        void clear_views();
+
+        std::size_t num_views() const;
+
+        const SearchIndex &get_index(std::size_t view) const;
+
+        /**
+         * @return cached index for this exact cloud or nullptr if it isn't one of the views.
+         */
+        const SearchIndex *find_index(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud) const;
+
+        /**
+         * @return cached pyramid for this exact cloud or nullptr if it isn't one of the views.
+         */
+        const ViewPyramid *find_pyramid(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud) const;
+
+        /**
+         * Align a source cloud to an indexed target.
+         *
+         * @param src source cloud.
+         * @param target index of the target cloud.
+         * @param guess initial source -> target transform.
+         * @return source -> target transform and stats.
+         */
+        ICPResult align(const pcl::PointCloud<pcl::PointXYZ> &src,
+                        const SearchIndex &target,
+                        const Eigen::Matrix4f &guess = Eigen::Matrix4f::Identity()) const;
+
+        /**
+         * Build the pyramid levels for a cloud using the current pyramid_leaf_sizes.
+         * For point to plane the proxies get neighbor normals, the full level uses the given normals if any.
+         */
+        ViewPyramid build_pyramid(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                                  const std::shared_ptr<pcl::PointCloud<pcl::Normal>> &normals = nullptr) const;
+
+        /**
+         * Coarse to fine alignment: run ICP on each proxy level, feeding the transform to the next level, and
+         * finish with at most full_resolution_iterations on the full clouds.
+         * Both pyramids must have been built with the same leaf sizes.
+         */
+        ICPResult align_pyramid(const ViewPyramid &src, const ViewPyramid &target,
+                                const Eigen::Matrix4f &guess = Eigen::Matrix4f::Identity()) const;
+
+        /**
+         * Align two cached views, through the pyramid if one is configured.
+         */
+        ICPResult align_views(std::size_t src, std::size_t target,
+                              const Eigen::Matrix4f &guess = Eigen::Matrix4f::Identity()) const;
+
+        const ICPParams &get_params() const;
+
+        void set_params(const ICPParams &params);
+
+        static nlohmann::json stats_to_json(const ICPStats &stats);
+
+    private:
+        ICPParams params;
+        std::vector<ViewPyramid> views;
+
+        ICPResult align_level(const pcl::PointCloud<pcl::PointXYZ> &src, const SearchIndex &target,
+                              const Eigen::Matrix4f &guess, int max_iterations, double max_distance,
+                              bool score) const;
+    };
+}
+
+#endif //SWAG_SCANNER_ICPENGINE_H
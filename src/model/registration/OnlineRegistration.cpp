@@ -0,0 +1,71 @@
+#include "OnlineRegistration.h"
+#include "Algorithms.h"
+#include <cmath>
+
+registration::OnlineRegistration::OnlineRegistration(const ICPParams &params, float angle,
+                                                     QualityThresholds thresholds) :
+        engine(params), angle(angle), thresholds(thresholds) {}
+
+registration::ViewQuality
+registration::OnlineRegistration::add_view(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                                           const std::shared_ptr<pcl::PointCloud<pcl::Normal>> &normals) {
+    ViewQuality quality;
+    quality.view = views.size();
+    ViewPyramid pyramid = engine.build_pyramid(cloud, normals);
+
+    if (views.empty()) {
+        poses.push_back(Eigen::Matrix4f::Identity());
+    } else {
+        // maps this view into the previous one if the turntable did exactly what it was told
+        Eigen::Matrix4f guess = algos::z_rotation_matrix(angle);
+        ICPResult result = engine.align_pyramid(pyramid, previous, guess);
+        quality.icp = result.stats;
+
+        Eigen::Matrix4f deviation = guess.inverse() * result.transform;
+        double cos_angle = (deviation.topLeftCorner<3, 3>().trace() - 1) / 2;
+        quality.deviation_deg = std::acos(std::max(-1.0, std::min(1.0, cos_angle))) * 180 / M_PI;
+        quality.deviation_m = deviation.topRightCorner<3, 1>().norm();
+
+        if (!result.stats.converged) {
+            quality.reason = "ICP did not converge (" + result.stats.stop_reason + ")";
+        } else if (result.stats.overlap < thresholds.min_overlap) {
+            quality.reason = "only " + std::to_string(result.stats.overlap) +
+                             " of the view overlaps the previous one";
+        } else if (result.stats.inlier_rmse > thresholds.max_inlier_rmse) {
+            quality.reason = "inlier RMSE " + std::to_string(result.stats.inlier_rmse) + " above " +
+                             std::to_string(thresholds.max_inlier_rmse);
+        } else if (quality.deviation_deg > thresholds.max_deviation_deg) {
+            quality.reason = "rotation is " + std::to_string(quality.deviation_deg) +
+                             " degrees off the turntable angle";
+        }
+        quality.good = quality.reason.empty();
+        poses.push_back(poses.back() * (quality.good ? result.transform : guess));
+    }
+
+    previous = std::move(pyramid);
+    views.push_back(cloud);
+    qualities.push_back(quality);
+    return quality;
+}
+
+const std::vector<Eigen::Matrix4f> &registration::OnlineRegistration::get_poses() const {
+    return poses;
+}
+
+const std::vector<std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>> &
+registration::OnlineRegistration::get_views() const {
+    return views;
+}
+
+const std::vector<registration::ViewQuality> &registration::OnlineRegistration::get_qualities() const {
+    return qualities;
+}
+
+nlohmann::json registration::OnlineRegistration::quality_to_json(const ViewQuality &quality) {
+    return {{"view",          quality.view},
+            {"good",          quality.good},
+            {"reason",        quality.reason},
+            {"deviation_deg", quality.deviation_deg},
+            {"deviation_m",   quality.deviation_m},
+            {"icp",           ICPEngine::stats_to_json(quality.icp)}};
+}
@@ -0,0 +1,80 @@
+#ifndef SWAG_SCANNER_ONLINEREGISTRATION_H
+#define SWAG_SCANNER_ONLINEREGISTRATION_H
+
+#include "ICPEngine.h"
+
+namespace registration {
+
+    /**
+     * How far a view may stray before it gets flagged for a recapture.
+     * Consecutive views only partly overlap, so the match is judged on the source points within
+     * ICPParams::max_correspondence_distance of the previous view, not on pcl style fitness over every point.
+     */
+    struct QualityThresholds {
+        double max_inlier_rmse = .003;     /** RMS distance to the previous view over the overlap, m */
+        double min_overlap = .3;           /** share of the view within max_correspondence_distance of the
+                                               previous view */
+        double max_deviation_deg = 3;      /** rotation between the ICP result and the turntable angle */
+    };
+
+    /**
+     * Live quality of one registered view.
+     */
+    struct ViewQuality {
+        std::size_t view = 0;
+        bool good = true;
+        std::string reason;                /** why the view was flagged, empty if it is good */
+        double deviation_deg = 0;          /** rotation between the ICP result and the turntable angle */
+        double deviation_m = 0;            /** translation between the ICP result and the turntable angle */
+        ICPStats icp;
+    };
+
+    /**
+     * Registers views one at a time as they come off the turntable. Each new view is aligned against the
+     * previous one with the turntable angle as the guess, so the cost per view stays constant and the
+     * poses are ready right after the last capture. Only the previous view's pyramid is kept.
+     * Views that fail the quality checks fall back to the turntable angle so they don't bend the chain.
+     * Not thread safe, feed it from one thread.
+     */
+    class OnlineRegistration {
+    public:
+        /**
+         * @param params ICP settings.
+         * @param angle degrees the turntable turns between views.
+         * @param thresholds quality checks.
+         */
+        OnlineRegistration(const ICPParams &params, float angle, QualityThresholds thresholds = QualityThresholds());
+
+        /**
+         * Register the next view against the previous one.
+         *
+         * @param cloud view in world coordinates. It is kept, don't modify it afterwards.
+         * @param normals optional normals of the view.
+         * @return quality of the view.
+         */
+        ViewQuality add_view(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                             const std::shared_ptr<pcl::PointCloud<pcl::Normal>> &normals = nullptr);
+
+        /**
+         * @return pose of every view so far in the frame of view 0.
+         */
+        const std::vector<Eigen::Matrix4f> &get_poses() const;
+
+        const std::vector<std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>> &get_views() const;
+
+        const std::vector<ViewQuality> &get_qualities() const;
+
+        static nlohmann::json quality_to_json(const ViewQuality &quality);
+
+    private:
+        ICPEngine engine;
+        float angle;
+        QualityThresholds thresholds;
+        ViewPyramid previous;
+        std::vector<Eigen::Matrix4f> poses;
+        std::vector<std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>> views;
+        std::vector<ViewQuality> qualities;
+    };
+}
+
+#endif //SWAG_SCANNER_ONLINEREGISTRATION_H
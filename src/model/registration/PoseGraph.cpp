@@ -0,0 +1,184 @@
+#include "PoseGraph.h"
+#include "Parallel.h"
+#include <Eigen/Geometry>
+#include <Eigen/Sparse>
+#include <stdexcept>
+#include <string>
+
+namespace {
+    using Vector6d = Eigen::Matrix<double, 6, 1>;
+    using Matrix6d = Eigen::Matrix<double, 6, 6>;
+
+    Eigen::Vector3d rotation_log(const Eigen::Matrix3d &rot) {
+        Eigen::Quaterniond q(rot);
+        q.normalize();
+        if (q.w() < 0) {
+            q.coeffs() *= -1;
+        }
+        Eigen::Vector3d v = q.vec();
+        double sin_half = v.norm();
+        if (sin_half < 1e-12) {
+            return 2 * v;
+        }
+        return v * (2 * std::atan2(sin_half, q.w()) / sin_half);
+    }
+
+    Eigen::Matrix3d rotation_exp(const Eigen::Vector3d &w) {
+        double angle = w.norm();
+        if (angle < 1e-15) {
+            return Eigen::Matrix3d::Identity();
+        }
+        return Eigen::AngleAxisd(angle, w / angle).toRotationMatrix();
+    }
+
+    /**
+     * Apply a perturbation: left multiply the rotation, add to the translation.
+     */
+    Eigen::Matrix4d perturb(const Eigen::Matrix4d &pose, const Vector6d &delta) {
+        Eigen::Matrix4d out = pose;
+        out.topLeftCorner<3, 3>() = rotation_exp(delta.head<3>()) * pose.topLeftCorner<3, 3>();
+        out.topRightCorner<3, 1>() += delta.tail<3>();
+        return out;
+    }
+
+    Eigen::Matrix4d rigid_inverse(const Eigen::Matrix4d &pose) {
+        Eigen::Matrix4d inv = Eigen::Matrix4d::Identity();
+        inv.topLeftCorner<3, 3>() = pose.topLeftCorner<3, 3>().transpose();
+        inv.topRightCorner<3, 1>() = -inv.topLeftCorner<3, 3>() * pose.topRightCorner<3, 1>();
+        return inv;
+    }
+
+    /**
+     * Linearized edge: residual and central difference Jacobians for both endpoints.
+     */
+    struct LinearEdge {
+        Vector6d residual;
+        Matrix6d jac_from;
+        Matrix6d jac_to;
+    };
+
+    LinearEdge linearize(const registration::PoseEdge &edge,
+                         const Eigen::Matrix4d &pose_from,
+                         const Eigen::Matrix4d &pose_to) {
+        const double h = 1e-7;
+        LinearEdge lin;
+        lin.residual = registration::PoseGraph::edge_residual(pose_from, pose_to, edge.measurement);
+        for (int k = 0; k < 6; k++) {
+            Vector6d d = Vector6d::Zero();
+            d[k] = h;
+            lin.jac_from.col(k) = (registration::PoseGraph::edge_residual(perturb(pose_from, d), pose_to,
+                                                                          edge.measurement) -
+                                   registration::PoseGraph::edge_residual(perturb(pose_from, -d), pose_to,
+                                                                          edge.measurement)) / (2 * h);
+            lin.jac_to.col(k) = (registration::PoseGraph::edge_residual(pose_from, perturb(pose_to, d),
+                                                                        edge.measurement) -
+                                 registration::PoseGraph::edge_residual(pose_from, perturb(pose_to, -d),
+                                                                        edge.measurement)) / (2 * h);
+        }
+        return lin;
+    }
+
+    void add_block(std::vector<Eigen::Triplet<double>> &triplets, long row, long col, const Matrix6d &block) {
+        for (int r = 0; r < 6; r++) {
+            for (int c = 0; c < 6; c++) {
+                triplets.emplace_back(row + r, col + c, block(r, c));
+            }
+        }
+    }
+}
+
+registration::PoseGraph::PoseGraph(const std::vector<Eigen::Matrix4d> &initial_poses) : poses(initial_poses) {}
+
+void registration::PoseGraph::add_edge(std::size_t from, std::size_t to,
+                                       const Eigen::Matrix4d &measurement,
+                                       const Eigen::Matrix<double, 6, 6> &information) {
+    if (from >= poses.size() || to >= poses.size() || from == to) {
+        throw std::invalid_argument("invalid pose graph edge " + std::to_string(from) + " -> " +
+                                    std::to_string(to) + " for " + std::to_string(poses.size()) + " views");
+    }
+    edges.push_back({from, to, measurement, information});
+}
+
+int registration::PoseGraph::optimize(int max_iterations, double tolerance) {
+    const std::size_t num_free = poses.size() > 0 ? poses.size() - 1 : 0;
+    if (num_free == 0 || edges.empty()) {
+        return 0;
+    }
+    const long dim = long(6 * num_free);
+
+    int iteration = 0;
+    while (iteration < max_iterations) {
+        iteration++;
+        std::vector<LinearEdge> linear(edges.size());
+        parallel::for_each_index(edges.size(), [&](std::size_t e) {
+            linear[e] = linearize(edges[e], poses[edges[e].from], poses[edges[e].to]);
+        });
+
+        // assemble in edge order, node 0 is fixed so its columns are dropped
+        std::vector<Eigen::Triplet<double>> triplets;
+        triplets.reserve(edges.size() * 4 * 36);
+        Eigen::VectorXd b = Eigen::VectorXd::Zero(dim);
+        for (std::size_t e = 0; e < edges.size(); e++) {
+            const PoseEdge &edge = edges[e];
+            const LinearEdge &lin = linear[e];
+            const long from = long(edge.from) - 1;
+            const long to = long(edge.to) - 1;
+            if (from >= 0) {
+                add_block(triplets, 6 * from, 6 * from, lin.jac_from.transpose() * edge.information * lin.jac_from);
+                b.segment<6>(6 * from) += lin.jac_from.transpose() * edge.information * lin.residual;
+            }
+            if (to >= 0) {
+                add_block(triplets, 6 * to, 6 * to, lin.jac_to.transpose() * edge.information * lin.jac_to);
+                b.segment<6>(6 * to) += lin.jac_to.transpose() * edge.information * lin.residual;
+            }
+            if (from >= 0 && to >= 0) {
+                Matrix6d cross = lin.jac_from.transpose() * edge.information * lin.jac_to;
+                add_block(triplets, 6 * from, 6 * to, cross);
+                add_block(triplets, 6 * to, 6 * from, cross.transpose());
+            }
+        }
+        Eigen::SparseMatrix<double> hessian(dim, dim);
+        hessian.setFromTriplets(triplets.begin(), triplets.end());
+
+        Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> solver(hessian);
+        if (solver.info() != Eigen::Success) {
+            throw std::runtime_error("pose graph is not solvable, every view needs an edge");
+        }
+        Eigen::VectorXd delta = solver.solve(-b);
+
+        for (std::size_t i = 0; i < num_free; i++) {
+            poses[i + 1] = perturb(poses[i + 1], delta.segment<6>(6 * long(i)));
+        }
+        if (delta.lpNorm<Eigen::Infinity>() < tolerance) {
+            break;
+        }
+    }
+    return iteration;
+}
+
+double registration::PoseGraph::total_error() const {
+    double error = 0;
+    for (const auto &edge : edges) {
+        Vector6d r = edge_residual(poses[edge.from], poses[edge.to], edge.measurement);
+        error += r.dot(edge.information * r);
+    }
+    return error;
+}
+
+const std::vector<Eigen::Matrix4d> &registration::PoseGraph::get_poses() const {
+    return poses;
+}
+
+const std::vector<registration::PoseEdge> &registration::PoseGraph::get_edges() const {
+    return edges;
+}
+
+Eigen::Matrix<double, 6, 1> registration::PoseGraph::edge_residual(const Eigen::Matrix4d &pose_from,
+                                                                   const Eigen::Matrix4d &pose_to,
+                                                                   const Eigen::Matrix4d &measurement) {
+    Eigen::Matrix4d error = rigid_inverse(measurement) * rigid_inverse(pose_to) * pose_from;
+    Vector6d r;
+    r.head<3>() = rotation_log(error.topLeftCorner<3, 3>());
+    r.tail<3>() = error.topRightCorner<3, 1>();
+    return r;
+}
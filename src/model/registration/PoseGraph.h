@@ -0,0 +1,77 @@
+#ifndef SWAG_SCANNER_POSEGRAPH_H
+#define SWAG_SCANNER_POSEGRAPH_H
+
+#include <Eigen/Core>
+#include <vector>
+
+namespace registration {
+
+    /**
+     * Relative pose measured between two views, usually by ICP.
+     * measurement maps points of view "from" into the frame of view "to", so ideally
+     * measurement == pose[to]^-1 * pose[from].
+     */
+    struct PoseEdge {
+        std::size_t from;
+        std::size_t to;
+        Eigen::Matrix4d measurement;
+        Eigen::Matrix<double, 6, 6> information; /** inverse covariance of (rotation log, translation) */
+    };
+
+    /**
+     * Sparse pose graph over SO(3) x R^3 solved with Gauss-Newton.
+     * Every node is the pose of one view in the frame of view 0, and node 0 stays fixed. With a loop closure
+     * edge between the last and first view the error that ICP drift builds up around the turntable gets
+     * spread over all the edges instead of landing on the last view.
+     */
+    class PoseGraph {
+    public:
+
+        /**
+         * @param initial_poses starting pose of every view, e.g. from the turntable angle.
+         */
+        explicit PoseGraph(const std::vector<Eigen::Matrix4d> &initial_poses);
+
+        /**
+         * Add a relative pose constraint between two views.
+         *
+         * @throws invalid_argument if either node doesn't exist or from == to.
+         */
+        void add_edge(std::size_t from, std::size_t to,
+                      const Eigen::Matrix4d &measurement,
+                      const Eigen::Matrix<double, 6, 6> &information = Eigen::Matrix<double, 6, 6>::Identity());
+
+        /**
+         * Run Gauss-Newton until the update gets tiny. Each step assembles the sparse normal equations from
+         * the edges (linearized in parallel) and solves them with a sparse LDLT.
+         *
+         * @param max_iterations upper bound on Gauss-Newton steps.
+         * @param tolerance stop when the largest update component falls below this.
+         * @return number of iterations run.
+         * @throws runtime_error if the system can't be factorized, e.g. a view has no edges.
+         */
+        int optimize(int max_iterations = 20, double tolerance = 1e-8);
+
+        /**
+         * @return sum of squared, information weighted edge residuals.
+         */
+        double total_error() const;
+
+        const std::vector<Eigen::Matrix4d> &get_poses() const;
+
+        const std::vector<PoseEdge> &get_edges() const;
+
+        /**
+         * Residual of one edge: rotation log and translation of measurement^-1 * pose_to^-1 * pose_from.
+         */
+        static Eigen::Matrix<double, 6, 1> edge_residual(const Eigen::Matrix4d &pose_from,
+                                                         const Eigen::Matrix4d &pose_to,
+                                                         const Eigen::Matrix4d &measurement);
+
+    private:
+        std::vector<Eigen::Matrix4d> poses;
+        std::vector<PoseEdge> edges;
+    };
+}
+
+#endif //SWAG_SCANNER_POSEGRAPH_H
@@ -1,12 +1,29 @@
 #include "ScanModel.h"
+#include "FilterPipeline.h"
+#include "OnlineRegistration.h"
+#include "Parallel.h"
+#include "Normal.h"
+#include "Transforms.h"
+#include "DepthBackground.h"
+#include "CameraTypes.h"
 #include "Logger.h"
+#include "MortonOrder.h"
+#include <nlohmann/json.hpp>
+#include <chrono>
 #include <filesystem>
 
 
 namespace fs = std::filesystem;
+using json = nlohmann::json;
 
 model::ScanModel::ScanModel() : file_handler() {}
 
+model::ScanModel::~ScanModel() {
+    for (auto &task : online_tasks) {
+        task.wait();
+    }
+}
+
 void model::ScanModel::set_scan(const std::string &scan_name) {
     file_handler.set_scan(scan_name);
 }
@@ -37,4 +54,137 @@ void model::ScanModel::update_info_json(int deg, int num_rot) {
     file_handler.update_info_json(date, deg, num_rot, info_json_path);
 }
 
+bool model::ScanModel::load_background(const camera::intrinsics &intrinsics) {
+    background.clear();
+    json config = file::IFileHandler::get_swag_scanner_config_json();
+    if (!config.value("background_subtraction", true)) {
+        return false;
+    }
+    background = file_handler.load_background(intrinsics.width, intrinsics.height);
+    if (background.empty()) {
+        logger::info("no background captured for this calibration, scanning without background subtraction");
+        return false;
+    }
+    float margin = config.value("background_margin", .005f);
+    background_margin = uint16_t(std::lround(margin / intrinsics.depth_scale));
+    logger::info("subtracting the calibration background");
+    return true;
+}
+
+void model::ScanModel::subtract_background(std::vector<uint16_t> &depth_frame) {
+    if (background.empty()) {
+        return;
+    }
+    std::size_t cleared = algos::subtract_depth_background(depth_frame, background, background_margin);
+    LOG_DEBUG("background subtraction cleared {} pixels", cleared);
+}
+
+bool model::ScanModel::start_online_registration(int deg) {
+    json config = file::IFileHandler::get_swag_scanner_config_json();
+    if (!config.value("online_registration", false)) {
+        return false;
+    }
+    registration::ICPParams params;
+    std::string icp_method = config.value("registration_icp", std::string("point_to_point"));
+    if (icp_method == "point_to_plane") {
+        params.method = registration::ICPMethod::POINT_TO_PLANE;
+    } else if (icp_method != "point_to_point") {
+        throw std::invalid_argument("unknown registration_icp in config.json: " + icp_method);
+    }
+    params.pyramid_leaf_sizes = config.value("registration_pyramid", std::vector<float>());
+    params.full_resolution_iterations = config.value("registration_full_iterations", 5);
+    // the turntable guess is already within millimeters, a tight radius keeps the non overlapping part of a
+    // view out of both the alignment and the quality score
+    params.max_correspondence_distance = config.value("online_max_correspondence_distance", .005);
+    registration::QualityThresholds thresholds;
+    thresholds.max_inlier_rmse = config.value("online_max_rmse", thresholds.max_inlier_rmse);
+    thresholds.min_overlap = config.value("online_min_overlap", thresholds.min_overlap);
+    thresholds.max_deviation_deg = config.value("online_max_deviation", thresholds.max_deviation_deg);
 
+    json calibration_json = file_handler.get_calibration_json();
+    equations::Normal rot_axis(calibration_json["axis_direction"].get<std::vector<double>>());
+    auto origin = calibration_json["origin_point"].get<std::vector<double>>();
+    online_world = algos::calc_transform_to_world_matrix(pcl::PointXYZ(origin[0], origin[1], origin[2]), rot_axis);
+    online_volume = FilterPipeline::scan_volume(config);
+
+    online_pipeline = std::make_unique<FilterPipeline>(FilterPipeline::from_config(config, "scan_filter_pipeline"),
+                                                       *this);
+    online = std::make_unique<registration::OnlineRegistration>(params, float(deg), thresholds);
+    online_tasks.clear();
+    online_angle = float(deg);
+    if (online_pool == nullptr) {
+        online_pool = std::make_unique<parallel::ThreadPool>(1);
+    }
+    logger::info("online registration is on");
+    return true;
+}
+
+void model::ScanModel::register_view_async(const std::string &cloud_name) {
+    if (online == nullptr) {
+        return;
+    }
+    std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> raw = clouds[clouds_map[cloud_name]];
+    auto task = std::make_shared<std::packaged_task<void()>>([this, raw, cloud_name]() {
+        // work on a copy, the model keeps the raw cloud as the captured view
+        auto view = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+        transforms::transform_cloud_cropped(*raw, *view, online_world, online_volume);
+        std::shared_ptr<pcl::PointCloud<pcl::Normal>> normals;
+        online_pipeline->run(view, normals);
+        registration::ViewQuality quality = online->add_view(view, normals);
+        file_handler.save_cloud(view, std::to_string(quality.view) + ".pcd", CloudType::Type::FILTERED);
+        if (quality.good) {
+            LOG_INFO("online registration of {}: fitness {}, {} degrees off the turntable",
+                     cloud_name, quality.icp.fitness, quality.deviation_deg);
+        } else {
+            LOG_ERROR("view {} looks bad, consider recapturing it: {}", cloud_name, quality.reason);
+        }
+    });
+    online_tasks.push_back(task->get_future());
+    online_pool->submit([task]() { (*task)(); });
+}
+
+std::vector<std::size_t> model::ScanModel::finish_online_registration() {
+    std::vector<std::size_t> bad_views;
+    if (online == nullptr) {
+        return bad_views;
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (auto &task : online_tasks) {
+        task.get();
+    }
+    online_tasks.clear();
+
+    json registration_json = {{"method", "online"},
+                              {"angle",  online_angle},
+                              {"views",  json::array()}};
+    for (const auto &quality : online->get_qualities()) {
+        registration_json["views"].push_back(registration::OnlineRegistration::quality_to_json(quality));
+        if (!quality.good) {
+            bad_views.push_back(quality.view);
+        }
+    }
+    file_handler.update_registration_json(registration_json);
+
+    json config = file::IFileHandler::get_swag_scanner_config_json();
+    std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> global_cloud;
+    if (config.value("merge_method", std::string("concatenate")) == "voxel") {
+        global_cloud = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>(
+                algos::merge_views_voxel_hash(online->get_views(), online->get_poses(),
+                                              config.value("voxel_merge_leaf_size", .001f),
+                                              config.value("voxel_merge_min_views", 2)));
+    } else {
+        // tsdf fusion needs the processing model, online registration concatenates instead
+        global_cloud = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>(
+                algos::merge_transformed_clouds(online->get_views(), online->get_poses()));
+        remove_outliers(global_cloud, 50, 1);
+    }
+    algos::morton_sort(*global_cloud);
+    save_cloud(global_cloud, "REGISTERED.pcd", CloudType::Type::REGISTERED);
+    double wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    LOG_INFO("online registration finished {} ms after the last capture, {} of {} views flagged",
+             wait_ms, bad_views.size(), online->get_views().size());
+
+    online.reset();
+    online_pipeline.reset();
+    return bad_views;
+}
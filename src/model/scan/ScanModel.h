@@ -3,6 +3,8 @@
 
 #include "IModel.h"
 #include "ScanFileHandler.h"
+#include "Transforms.h"
+#include <future>
 
 namespace pcl {
     class PointXYZ;
@@ -11,7 +13,21 @@ namespace pcl {
     class PointCloud;
 }
 
+namespace parallel {
+    class ThreadPool;
+}
+
+namespace camera {
+    struct intrinsics;
+}
+
+namespace registration {
+    class OnlineRegistration;
+}
+
 namespace model {
+    class FilterPipeline;
+
     /**
      * Represents a model for scanning.
      */
@@ -19,7 +35,10 @@ namespace model {
     public:
         ScanModel();
 
-        ~ScanModel() = default;
+        /**
+         * Waits for online registration work that is still queued.
+         */
+        ~ScanModel();
 
 
         /**
@@ -50,10 +69,72 @@ namespace model {
          */
         void update_info_json(int deg, int num_rot);
 
+        /**
+         * Load the background depth image cached with the scan's calibration, if "background_subtraction" is
+         * on in settings/config.json. Call after update_info_json so the scan's calibration is known.
+         *
+         * @param intrinsics intrinsics of the depth frames that will be subtracted.
+         * @return true if depth frames will have the background subtracted.
+         */
+        bool load_background(const camera::intrinsics &intrinsics);
+
+        /**
+         * Clear every pixel of a depth frame that isn't at least "background_margin" meters in front of the
+         * background, so only the object gets deprojected. Does nothing without a background.
+         *
+         * @param depth_frame raw depth frame, filtered in place.
+         */
+        void subtract_background(std::vector<uint16_t> &depth_frame);
+
+        /**
+         * Start registering views while the scan runs if "online_registration" is true in
+         * settings/config.json. Views are moved to world coordinates, run through the scan filter pipeline and
+         * aligned to the previous view on one background thread, so the turntable keeps moving.
+         * Call after update_info_json so the scan's calibration is known.
+         *
+         * @param deg degrees the turntable turns between views.
+         * @return true if online registration is on.
+         */
+        bool start_online_registration(int deg);
+
+        /**
+         * Queue a captured view for online registration. Returns right away, a view that fails the quality
+         * checks ("online_max_rmse", "online_min_overlap", "online_max_deviation") is logged as an error as
+         * soon as it is done so it can still be recaptured. Does nothing if online registration is off.
+         *
+         * @param cloud_name name of a cloud added to the model.
+         */
+        void register_view_async(const std::string &cloud_name);
+
+        /**
+         * Wait for the queued views, then merge them into REGISTERED.pcd and write the per view quality to
+         * info/registration.json. Views are concatenated unless "merge_method" asks for "voxel".
+         * Does nothing if online registration is off.
+         *
+         * @return indices of the views that failed the quality checks.
+         */
+        std::vector<std::size_t> finish_online_registration();
+
     private:
         std::shared_ptr<spdlog::logger> logger;
         file::ScanFileHandler file_handler;
 
+        std::vector<uint16_t> background;
+        uint16_t background_margin = 0;
+
+        std::unique_ptr<FilterPipeline> online_pipeline;
+        std::unique_ptr<registration::OnlineRegistration> online;
+        std::vector<std::future<void>> online_tasks;
+        Eigen::Matrix4f online_world = Eigen::Matrix4f::Identity();
+        transforms::CylinderCrop online_volume{};
+        float online_angle = 0;
+
+        /**
+         * One worker so views register in capture order. Declared last so it is joined before the
+         * registration state it works on goes away.
+         */
+        std::unique_ptr<parallel::ThreadPool> online_pool;
+
     };
 }
 
@@ -3,7 +3,13 @@
 #include "Plane.h"
 #include "CameraTypes.h"
 #include "Logger.h"
-#include <pcl/common/transforms.h>
+#include "Parallel.h"
+#include "VoxelHashMap.h"
+#include "Transforms.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
 
 pcl::PointXYZ algos::deproject_pixel_to_point(float x_pixel,
                                               float y_pixel,
@@ -47,41 +53,127 @@ bool algos::check_point_in_plane(const pcl::PointXYZ &pt,
 
 
     double lhs = pt.x * plane.A + pt.y * plane.B + pt.z * plane.C + plane.D;
-    if (lhs > -delta && lhs < delta) {
-        logger::info("found point for projection with error: " + std::to_string(lhs));
-        return true;
-    }
-    return false;
+    return lhs > -delta && lhs < delta;
 }
 
 pcl::PointXYZ algos::find_point_in_plane(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
                                          const equations::Plane &plane,
                                          double delta) {
-    for (const auto &pt: cloud->points) {
-        if (check_point_in_plane(pt, plane, delta)) {
-            return pt;
-        }
+    PlanePointQuery query = query_plane_points({cloud}, plane, delta);
+    if (query.found) {
+        LOG_INFO("found point for projection with error: {}", query.best_distance);
+        return query.best_inlier;
     }
-    logger::error("cannot find point in threshold, try loosening it");
+    LOG_ERROR("cannot find point in threshold, try loosening it");
     return pcl::PointXYZ(0, 0, 0);
 }
 
+void algos::plane_signed_distances(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                   const equations::Plane &plane,
+                                   std::vector<float> &distances) {
+    static_assert(sizeof(pcl::PointXYZ) == 4 * sizeof(float), "PointXYZ is expected to be x, y, z and padding");
+    const double norm = std::sqrt(plane.A * plane.A + plane.B * plane.B + plane.C * plane.C);
+    const Eigen::RowVector3f row(float(plane.A / norm), float(plane.B / norm), float(plane.C / norm));
+    const float offset = float(plane.D / norm);
+
+    distances.resize(cloud.points.size());
+    parallel::for_each_range(cloud.points.size(), 1 << 15, [&](std::size_t begin, std::size_t end) {
+        const Eigen::Index n = Eigen::Index(end - begin);
+        Eigen::Map<const Eigen::Matrix<float, 4, Eigen::Dynamic>> points(
+                reinterpret_cast<const float *>(cloud.points.data() + begin), 4, n);
+        Eigen::Map<Eigen::RowVectorXf> out(distances.data() + begin, n);
+        // only x, y, z are read, the padding lane may hold anything (0 * NaN would still be NaN)
+        out = (row * points.topRows<3>()).array() + offset;
+    });
+}
+
+algos::PlanePointQuery
+algos::query_plane_points(const std::vector<std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>> &clouds,
+                          const equations::Plane &plane,
+                          double delta) {
+    struct ChunkStats {
+        std::size_t inliers = 0;
+        double sum = 0;
+        double sum_sq = 0;
+        double max_abs = 0;
+        Eigen::Vector3d point_sum = Eigen::Vector3d::Zero();
+        float best = std::numeric_limits<float>::infinity();
+        std::size_t best_index = 0;
+    };
+    const std::size_t grain = 1 << 15;
+    const float threshold = float(delta);
+
+    PlanePointQuery query;
+    ChunkStats total;
+    std::vector<float> distances;
+    for (const auto &cloud : clouds) {
+        plane_signed_distances(*cloud, plane, distances);
+        std::vector<ChunkStats> chunks(parallel::num_chunks(distances.size(), grain));
+        parallel::for_each_range(distances.size(), grain, [&](std::size_t begin, std::size_t end) {
+            ChunkStats &c = chunks[begin / grain];
+            for (std::size_t i = begin; i < end; i++) {
+                const float d = distances[i];
+                const float abs = std::abs(d);
+                // false for NaN
+                if (!(abs < threshold)) {
+                    continue;
+                }
+                c.inliers++;
+                c.sum += d;
+                c.sum_sq += double(d) * d;
+                c.max_abs = std::max(c.max_abs, double(abs));
+                const pcl::PointXYZ &p = cloud->points[i];
+                c.point_sum += Eigen::Vector3d(p.x, p.y, p.z);
+                if (abs < c.best) {
+                    c.best = abs;
+                    c.best_index = i;
+                }
+            }
+        });
+        // chunk order, so the statistics don't depend on the number of threads
+        for (const ChunkStats &c : chunks) {
+            if (c.inliers == 0) {
+                continue;
+            }
+            total.inliers += c.inliers;
+            total.sum += c.sum;
+            total.sum_sq += c.sum_sq;
+            total.max_abs = std::max(total.max_abs, c.max_abs);
+            total.point_sum += c.point_sum;
+            if (c.best < total.best) {
+                total.best = c.best;
+                query.best_inlier = cloud->points[c.best_index];
+                query.best_distance = distances[c.best_index];
+            }
+        }
+    }
+    if (total.inliers == 0) {
+        return query;
+    }
+    const double n = double(total.inliers);
+    Eigen::Vector3d centroid = total.point_sum / n;
+    query.found = true;
+    query.inliers = total.inliers;
+    query.least_squares_point = pcl::PointXYZ(float(centroid[0]), float(centroid[1]), float(centroid[2]));
+    query.mean_distance = total.sum / n;
+    query.rms_distance = std::sqrt(total.sum_sq / n);
+    query.max_abs_distance = total.max_abs;
+    return query;
+}
 
 pcl::PointCloud<pcl::PointXYZ>
 algos::rotate_cloud_about_line(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
                                const std::vector<float> &pt,
                                const std::vector<float> &line_direction,
                                float theta) {
+    // one matrix for the whole cloud instead of trigonometry per point
+    Eigen::Matrix4f rotation = transforms::rotation_about_line(Eigen::Vector3f(pt[0], pt[1], pt[2]),
+                                                               Eigen::Vector3f(line_direction[0],
+                                                                               line_direction[1],
+                                                                               line_direction[2]),
+                                                               theta);
     pcl::PointCloud<pcl::PointXYZ> transformed;
-
-    transformed.resize(cloud->size());
-
-    for (int i = 0; i < cloud->size(); i++) {
-        transformed.points[i] = rotate_point_about_line(cloud->points[i],
-                                                        pt,
-                                                        line_direction,
-                                                        theta);
-    }
+    transforms::transform_cloud(*cloud, transformed, rotation);
     return transformed;
 }
 
@@ -98,14 +190,17 @@ pcl::PointXYZ algos::rotate_point_about_line(const pcl::PointXYZ &point,
     float u = line_direction[0];
     float v = line_direction[1];
     float w = line_direction[2];
+    const float cos_t = std::cos(theta);
+    const float sin_t = std::sin(theta);
+    const float dot = u * x + v * y + w * z;
 
     pcl::PointXYZ p;
-    p.x = (a * (v * v + w * w) - u * (b * v + c * w - u * x - v * y - w * z)) * (1 - cos(theta)) + x * cos(theta) +
-          (-c * v + b * w - w * y + v * z) * sin(theta);
-    p.y = (b * (u * u + w * w) - v * (a * u + c * w - u * x - v * y - w * z)) * (1 - cos(theta)) + y * cos(theta) +
-          (c * u - a * w + w * x - u * z) * sin(theta);
-    p.z = (c * (u * u + v * v) - w * (a * u + b * v - u * x - v * y - w * z)) * (1 - cos(theta)) + z * cos(theta) +
-          (-b * u + a * v - v * x + u * y) * sin(theta);
+    p.x = (a * (v * v + w * w) - u * (b * v + c * w - dot)) * (1 - cos_t) + x * cos_t +
+          (-c * v + b * w - w * y + v * z) * sin_t;
+    p.y = (b * (u * u + w * w) - v * (a * u + c * w - dot)) * (1 - cos_t) + y * cos_t +
+          (c * u - a * w + w * x - u * z) * sin_t;
+    p.z = (c * (u * u + v * v) - w * (a * u + b * v - dot)) * (1 - cos_t) + z * cos_t +
+          (-b * u + a * v - v * x + u * y) * sin_t;
 
     return p;
 }
@@ -113,11 +208,15 @@ pcl::PointXYZ algos::rotate_point_about_line(const pcl::PointXYZ &point,
 pcl::PointCloud<pcl::PointXYZ>
 algos::rotate_cloud_about_z_axis(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud, float theta) {
     pcl::PointCloud<pcl::PointXYZ> rotated;
+    transforms::transform_cloud(*cloud, rotated, z_rotation_matrix(theta));
+    return rotated;
+}
+
+Eigen::Matrix4f algos::z_rotation_matrix(float theta) {
     Eigen::Affine3f transform(Eigen::Affine3f::Identity());
     // note, rotating in negative direction
     transform.rotate(Eigen::AngleAxisf(-(theta * M_PI) / 180, Eigen::Vector3f::UnitZ()));
-    pcl::transformPointCloud(*cloud, rotated, transform);
-    return rotated;
+    return transform.matrix();
 }
 
 Eigen::Matrix4f algos::calc_transform_to_world_matrix(const pcl::PointXYZ &center,
@@ -139,8 +238,172 @@ Eigen::Matrix4f algos::calc_transform_to_world_matrix(const pcl::PointXYZ &cente
 void algos::transform_cloud_to_world(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
                                      const pcl::PointXYZ &center,
                                      const equations::Normal &ground_normal) {
-    Eigen::Matrix4f transform = calc_transform_to_world_matrix(center, ground_normal);
-    pcl::transformPointCloud(*cloud, *cloud, transform);
+    transforms::transform_cloud(*cloud, calc_transform_to_world_matrix(center, ground_normal));
+}
+
+std::size_t algos::remove_turntable(pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                   const Eigen::Vector3f &origin,
+                                   const Eigen::Vector3f &axis,
+                                   float diameter,
+                                   float surface_offset,
+                                   float max_height) {
+    static_assert(sizeof(pcl::PointXYZ) == 4 * sizeof(float), "PointXYZ is expected to be x, y, z and padding");
+    const float radius_sq = diameter * diameter / 4;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const std::size_t grain = 1 << 15;
+    std::vector<std::size_t> chunk_removed(parallel::num_chunks(cloud.points.size(), grain), 0);
+    parallel::for_each_range(cloud.points.size(), grain, [&](std::size_t begin, std::size_t end) {
+        const Eigen::Index n = Eigen::Index(end - begin);
+        Eigen::Map<Eigen::Matrix<float, 4, Eigen::Dynamic>> points(
+                reinterpret_cast<float *>(cloud.points.data() + begin), 4, n);
+        // heights and squared axis distances of the whole chunk at once
+        Eigen::Matrix<float, 3, Eigen::Dynamic> offsets = points.topRows<3>().colwise() - origin;
+        Eigen::ArrayXf height = (axis.transpose() * offsets).transpose().array();
+        Eigen::ArrayXf radial_sq = offsets.colwise().squaredNorm().transpose().array() - height.square();
+        // NaN fails every comparison, so it's never counted as kept
+        Eigen::Array<bool, Eigen::Dynamic, 1> keep = (height > surface_offset) && (height <= max_height) &&
+                                                     (radial_sq <= radius_sq);
+        Eigen::Array<bool, Eigen::Dynamic, 1> finite = height == height;
+        std::size_t removed = 0;
+        for (Eigen::Index k = 0; k < n; k++) {
+            if (!keep[k]) {
+                removed += finite[k];
+                points.col(k).head<3>().setConstant(nan);
+            }
+        }
+        chunk_removed[begin / grain] = removed;
+    });
+    std::size_t removed = 0;
+    for (std::size_t r : chunk_removed) {
+        removed += r;
+    }
+    if (removed > 0) {
+        cloud.is_dense = false;
+    }
+    return removed;
+}
+
+namespace {
+    /**
+     * Voxel key of every point relative to the min corner of the finite points, EMPTY_KEY for NaN points.
+     *
+     * @return false if there are no finite points.
+     * @throws invalid_argument if leaf_size is not positive or the points span more than 2^21 voxels on an axis.
+     */
+    bool compute_voxel_keys(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                            float leaf_size,
+                            std::vector<uint64_t> &keys) {
+        const auto &pts = cloud.points;
+        if (!(leaf_size > 0)) {
+            throw std::invalid_argument("voxel leaf size must be positive");
+        }
+        const std::size_t n = pts.size();
+        const std::size_t grain = 1 << 16;
+
+        // bounding box of the finite points, reduced per chunk so the result does not depend on threads
+        std::size_t chunks = parallel::num_chunks(n, grain);
+        std::vector<Eigen::Array3f> chunk_min(chunks, Eigen::Array3f::Constant(std::numeric_limits<float>::max()));
+        std::vector<Eigen::Array3f> chunk_max(chunks,
+                                              Eigen::Array3f::Constant(std::numeric_limits<float>::lowest()));
+        parallel::for_each_range(n, grain, [&](std::size_t begin, std::size_t end) {
+            Eigen::Array3f lo = chunk_min[begin / grain];
+            Eigen::Array3f hi = chunk_max[begin / grain];
+            for (std::size_t i = begin; i < end; i++) {
+                if (std::isfinite(pts[i].x) && std::isfinite(pts[i].y) && std::isfinite(pts[i].z)) {
+                    lo = lo.min(pts[i].getArray3fMap());
+                    hi = hi.max(pts[i].getArray3fMap());
+                }
+            }
+            chunk_min[begin / grain] = lo;
+            chunk_max[begin / grain] = hi;
+        });
+        Eigen::Array3f min_pt = Eigen::Array3f::Constant(std::numeric_limits<float>::max());
+        Eigen::Array3f max_pt = Eigen::Array3f::Constant(std::numeric_limits<float>::lowest());
+        for (std::size_t c = 0; c < chunks; c++) {
+            min_pt = min_pt.min(chunk_min[c]);
+            max_pt = max_pt.max(chunk_max[c]);
+        }
+        if ((min_pt > max_pt).any()) {
+            return false;
+        }
+        // keys are relative to the min corner, so only the real extent of the points matters
+        Eigen::Array3d extent = ((max_pt - min_pt).cast<double>() / leaf_size).floor();
+        if ((extent > double(algos::VOXEL_KEY_MAX)).any()) {
+            throw std::invalid_argument("voxel leaf size too small for the cloud extent, more than 2^21 voxels per axis");
+        }
+
+        keys.resize(n);
+        const float inv_leaf = 1.0f / leaf_size;
+        parallel::for_each_range(n, grain, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; i++) {
+                if (!(std::isfinite(pts[i].x) && std::isfinite(pts[i].y) && std::isfinite(pts[i].z))) {
+                    keys[i] = algos::VoxelHashMap<int>::EMPTY_KEY;
+                    continue;
+                }
+                Eigen::Array3f v = ((pts[i].getArray3fMap() - min_pt) * inv_leaf).floor();
+                v = v.min(float(algos::VOXEL_KEY_MAX)).max(0.f);
+                keys[i] = algos::pack_voxel_key(uint32_t(v[0]), uint32_t(v[1]), uint32_t(v[2]));
+            }
+        });
+        return true;
+    }
+}
+
+pcl::PointCloud<pcl::PointXYZ>
+algos::voxel_hash_downsample(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                             float leaf_size,
+                             VoxelPolicy policy) {
+    const std::size_t n = cloud->size();
+    const auto &pts = cloud->points;
+    pcl::PointCloud<pcl::PointXYZ> downsampled;
+    downsampled.header = cloud->header;
+    downsampled.sensor_origin_ = cloud->sensor_origin_;
+    downsampled.sensor_orientation_ = cloud->sensor_orientation_;
+    std::vector<uint64_t> keys;
+    if (!compute_voxel_keys(*cloud, leaf_size, keys)) {
+        return downsampled;
+    }
+
+    struct Accumulator {
+        Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+        uint32_t count = 0;
+        uint32_t first = 0;
+    };
+    auto shards = shard_accumulate_voxels<Accumulator>(keys, [&](Accumulator &acc, std::size_t i, bool inserted) {
+        if (inserted) {
+            acc.first = uint32_t(i);
+        }
+        if (policy == VoxelPolicy::CENTROID) {
+            acc.sum += pts[i].getVector3fMap().cast<double>();
+        }
+        acc.count++;
+    });
+
+    // gather the voxels from every shard and put them back in the order of their first point, O(n)
+    std::vector<pcl::PointXYZ> voxel_pts;
+    std::vector<int32_t> voxel_at(n, -1);
+    for (auto &shard : shards) {
+        shard.for_each([&](uint64_t key, const Accumulator &acc) {
+            voxel_at[acc.first] = int32_t(voxel_pts.size());
+            if (policy == VoxelPolicy::CENTROID) {
+                Eigen::Vector3d c = acc.sum / acc.count;
+                voxel_pts.emplace_back(c[0], c[1], c[2]);
+            } else {
+                voxel_pts.push_back(pts[acc.first]);
+            }
+        });
+    }
+
+    downsampled.points.reserve(voxel_pts.size());
+    for (std::size_t i = 0; i < n; i++) {
+        if (voxel_at[i] >= 0) {
+            downsampled.points.push_back(voxel_pts[voxel_at[i]]);
+        }
+    }
+    downsampled.width = downsampled.points.size();
+    downsampled.height = 1;
+    downsampled.is_dense = true;
+    return downsampled;
 }
 
 equations::Plane algos::average_planes(const std::vector<equations::Plane> &planes) {
@@ -156,4 +419,317 @@ equations::Plane algos::average_planes(const std::vector<equations::Plane> &plan
     avg.C /= planes.size();
     avg.D /= planes.size();
     return avg;
-}
\ No newline at end of file
+}
+
+pcl::PointCloud<pcl::Normal> algos::estimate_organized_normals(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                                               int step,
+                                                               float max_edge) {
+    if (cloud.height <= 1) {
+        throw std::invalid_argument("estimate_organized_normals needs an organized cloud");
+    }
+    const int width = cloud.width;
+    const int height = cloud.height;
+    const float max_edge_sq = max_edge * max_edge * step * step;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+
+    pcl::PointCloud<pcl::Normal> normals;
+    normals.points.resize(cloud.points.size());
+    normals.width = cloud.width;
+    normals.height = cloud.height;
+    normals.is_dense = false;
+
+    auto valid = [&](int u, int v, const Eigen::Vector3f &center) {
+        if (u < 0 || u >= width || v < 0 || v >= height) {
+            return false;
+        }
+        const pcl::PointXYZ &p = cloud.points[v * width + u];
+        return std::isfinite(p.z) && (p.getVector3fMap() - center).squaredNorm() <= max_edge_sq;
+    };
+    // central difference if both sides are usable, otherwise whichever side is
+    auto difference = [&](int u, int v, int du, int dv, const Eigen::Vector3f &center, Eigen::Vector3f &out) {
+        bool fwd = valid(u + du, v + dv, center);
+        bool back = valid(u - du, v - dv, center);
+        if (fwd && back) {
+            out = cloud.points[(v + dv) * width + u + du].getVector3fMap() -
+                  cloud.points[(v - dv) * width + u - du].getVector3fMap();
+        } else if (fwd) {
+            out = cloud.points[(v + dv) * width + u + du].getVector3fMap() - center;
+        } else if (back) {
+            out = center - cloud.points[(v - dv) * width + u - du].getVector3fMap();
+        } else {
+            return false;
+        }
+        return true;
+    };
+
+    parallel::for_each_range(height, 16, [&](std::size_t row_begin, std::size_t row_end) {
+        for (int v = int(row_begin); v < int(row_end); v++) {
+            for (int u = 0; u < width; u++) {
+                pcl::Normal &n = normals.points[v * width + u];
+                n.normal_x = n.normal_y = n.normal_z = n.curvature = nan;
+                const pcl::PointXYZ &p = cloud.points[v * width + u];
+                if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) {
+                    continue;
+                }
+                Eigen::Vector3f center = p.getVector3fMap();
+                Eigen::Vector3f dx, dy;
+                if (!difference(u, v, step, 0, center, dx) || !difference(u, v, 0, step, center, dy)) {
+                    continue;
+                }
+                Eigen::Vector3f normal = dx.cross(dy);
+                float length = normal.norm();
+                if (length < 1e-12f) {
+                    continue;
+                }
+                normal /= length;
+                n.normal_x = normal.x();
+                n.normal_y = normal.y();
+                n.normal_z = normal.z();
+                n.curvature = 0;
+            }
+        }
+    });
+    return normals;
+}
+
+pcl::PointCloud<pcl::Normal> algos::estimate_integral_normals(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                                              int radius,
+                                                              float max_edge) {
+    if (cloud.height <= 1) {
+        throw std::invalid_argument("estimate_integral_normals needs an organized cloud");
+    }
+    if (radius < 1) {
+        throw std::invalid_argument("integral image normal radius must be at least 1");
+    }
+    const int width = cloud.width;
+    const int height = cloud.height;
+    const int stride = width + 1;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+
+    // integral images with a zero first row and column: sums of the finite points and how many there are
+    std::vector<Eigen::Vector3d> sums(std::size_t(stride) * (height + 1), Eigen::Vector3d::Zero());
+    std::vector<uint32_t> counts(sums.size(), 0);
+    parallel::for_each_range(height, 16, [&](std::size_t row_begin, std::size_t row_end) {
+        for (int v = int(row_begin); v < int(row_end); v++) {
+            Eigen::Vector3d row_sum = Eigen::Vector3d::Zero();
+            uint32_t row_count = 0;
+            for (int u = 0; u < width; u++) {
+                const pcl::PointXYZ &p = cloud.points[v * width + u];
+                if (std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z)) {
+                    row_sum += p.getVector3fMap().cast<double>();
+                    row_count++;
+                }
+                sums[(v + 1) * stride + u + 1] = row_sum;
+                counts[(v + 1) * stride + u + 1] = row_count;
+            }
+        }
+    });
+    parallel::for_each_range(stride, 64, [&](std::size_t col_begin, std::size_t col_end) {
+        for (int v = 1; v <= height; v++) {
+            for (std::size_t u = col_begin; u < col_end; u++) {
+                sums[v * stride + u] += sums[(v - 1) * stride + u];
+                counts[v * stride + u] += counts[(v - 1) * stride + u];
+            }
+        }
+    });
+
+    // mean of the finite points in columns [u0, u1) and rows [v0, v1), clamped to the grid
+    auto box_mean = [&](int u0, int u1, int v0, int v1, Eigen::Vector3f &mean) {
+        u0 = std::max(u0, 0);
+        v0 = std::max(v0, 0);
+        u1 = std::min(u1, width);
+        v1 = std::min(v1, height);
+        if (u0 >= u1 || v0 >= v1) {
+            return false;
+        }
+        uint32_t count = counts[v1 * stride + u1] - counts[v0 * stride + u1] -
+                         counts[v1 * stride + u0] + counts[v0 * stride + u0];
+        if (count == 0) {
+            return false;
+        }
+        Eigen::Vector3d sum = sums[v1 * stride + u1] - sums[v0 * stride + u1] -
+                              sums[v1 * stride + u0] + sums[v0 * stride + u0];
+        mean = (sum / count).cast<float>();
+        return true;
+    };
+    // one side of the pixel, or the pixel itself if that side is empty or across a depth jump
+    auto side = [&](int u0, int u1, int v0, int v1, const Eigen::Vector3f &center, Eigen::Vector3f &out) {
+        if (!box_mean(u0, u1, v0, v1, out) || (out - center).norm() > max_edge * radius) {
+            out = center;
+            return false;
+        }
+        return true;
+    };
+
+    pcl::PointCloud<pcl::Normal> normals;
+    normals.points.resize(cloud.points.size());
+    normals.width = cloud.width;
+    normals.height = cloud.height;
+    normals.is_dense = false;
+    parallel::for_each_range(height, 16, [&](std::size_t row_begin, std::size_t row_end) {
+        for (int v = int(row_begin); v < int(row_end); v++) {
+            for (int u = 0; u < width; u++) {
+                pcl::Normal &n = normals.points[v * width + u];
+                n.normal_x = n.normal_y = n.normal_z = n.curvature = nan;
+                const pcl::PointXYZ &p = cloud.points[v * width + u];
+                if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) {
+                    continue;
+                }
+                const Eigen::Vector3f center = p.getVector3fMap();
+                Eigen::Vector3f left, right, up, down;
+                bool has_left = side(u - radius, u, v - radius, v + radius + 1, center, left);
+                bool has_right = side(u + 1, u + radius + 1, v - radius, v + radius + 1, center, right);
+                bool has_up = side(u - radius, u + radius + 1, v - radius, v, center, up);
+                bool has_down = side(u - radius, u + radius + 1, v + 1, v + radius + 1, center, down);
+                if (!(has_left || has_right) || !(has_up || has_down)) {
+                    continue;
+                }
+                Eigen::Vector3f normal = (right - left).cross(down - up);
+                float length = normal.norm();
+                if (length < 1e-12f) {
+                    continue;
+                }
+                normal /= length;
+                n.normal_x = normal.x();
+                n.normal_y = normal.y();
+                n.normal_z = normal.z();
+                n.curvature = 0;
+            }
+        }
+    });
+    return normals;
+}
+
+pcl::PointCloud<pcl::PointXYZ>
+algos::merge_transformed_clouds(const std::vector<std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>> &clouds,
+                                const std::vector<Eigen::Matrix4f> &poses,
+                                std::vector<std::size_t> *view_offsets) {
+    if (clouds.size() != poses.size()) {
+        throw std::invalid_argument("merge_transformed_clouds needs one transform per cloud");
+    }
+    struct Chunk {
+        std::size_t view, begin, end;
+        std::size_t offset = 0, count = 0;
+    };
+    const std::size_t grain = 1 << 16;
+    std::vector<Chunk> chunks;
+    for (std::size_t v = 0; v < clouds.size(); v++) {
+        const std::size_t n = clouds[v]->points.size();
+        for (std::size_t begin = 0; begin < n; begin += grain) {
+            chunks.push_back({v, begin, std::min(n, begin + grain)});
+        }
+    }
+    auto finite = [](const pcl::PointXYZ &p) {
+        return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+    };
+
+    // count, prefix sum, then fill, so the output is allocated exactly once
+    parallel::for_each_index(chunks.size(), [&](std::size_t c) {
+        const auto &points = clouds[chunks[c].view]->points;
+        chunks[c].count = std::count_if(points.begin() + chunks[c].begin, points.begin() + chunks[c].end, finite);
+    });
+    std::size_t total = 0;
+    for (auto &chunk : chunks) {
+        chunk.offset = total;
+        total += chunk.count;
+    }
+    if (view_offsets != nullptr) {
+        view_offsets->assign(clouds.size() + 1, 0);
+        for (const auto &chunk : chunks) {
+            (*view_offsets)[chunk.view + 1] += chunk.count;
+        }
+        for (std::size_t v = 0; v < clouds.size(); v++) {
+            (*view_offsets)[v + 1] += (*view_offsets)[v];
+        }
+    }
+
+    pcl::PointCloud<pcl::PointXYZ> merged;
+    merged.points.resize(total);
+    merged.width = total;
+    merged.height = 1;
+    merged.is_dense = true;
+    parallel::for_each_index(chunks.size(), [&](std::size_t c) {
+        const Chunk &chunk = chunks[c];
+        const auto &points = clouds[chunk.view]->points;
+        const Eigen::Matrix4f &transform = poses[chunk.view];
+        std::size_t out = chunk.offset;
+        for (std::size_t i = chunk.begin; i < chunk.end; i++) {
+            if (!finite(points[i])) {
+                continue;
+            }
+            transforms::transform_point(transform, points[i], merged.points[out++]);
+        }
+    });
+    return merged;
+}
+
+pcl::PointCloud<pcl::PointXYZ>
+algos::merge_views_voxel_hash(const std::vector<std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>> &clouds,
+                              const std::vector<Eigen::Matrix4f> &poses,
+                              float leaf_size,
+                              int min_views) {
+    if (min_views < 1) {
+        throw std::invalid_argument("voxel merge needs min_views >= 1");
+    }
+    std::vector<std::size_t> view_offsets;
+    const pcl::PointCloud<pcl::PointXYZ> merged = merge_transformed_clouds(clouds, poses, &view_offsets);
+    const auto &pts = merged.points;
+    const std::size_t n = pts.size();
+    pcl::PointCloud<pcl::PointXYZ> kept;
+    std::vector<uint64_t> keys;
+    if (!compute_voxel_keys(merged, leaf_size, keys)) {
+        return kept;
+    }
+    std::vector<uint32_t> view_of(n);
+    parallel::for_each_index(clouds.size(), [&](std::size_t v) {
+        std::fill(view_of.begin() + view_offsets[v], view_of.begin() + view_offsets[v + 1], uint32_t(v));
+    });
+
+    struct Accumulator {
+        Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+        uint32_t count = 0;
+        uint32_t first = 0;
+        uint32_t views = 0;
+        uint32_t last_view = ~0u;
+    };
+    auto shards = shard_accumulate_voxels<Accumulator>(keys, [&](Accumulator &acc, std::size_t i, bool inserted) {
+        if (inserted) {
+            acc.first = uint32_t(i);
+        }
+        acc.sum += pts[i].getVector3fMap().cast<double>();
+        acc.count++;
+        // shards see points in index order and the merged cloud is view by view, so views only go up
+        if (view_of[i] != acc.last_view) {
+            acc.last_view = view_of[i];
+            acc.views++;
+        }
+    });
+
+    std::vector<pcl::PointXYZ> voxel_pts;
+    std::vector<int32_t> voxel_at(n, -1);
+    std::size_t voxels = 0;
+    for (auto &shard : shards) {
+        voxels += shard.size();
+        shard.for_each([&](uint64_t key, const Accumulator &acc) {
+            if (acc.views < uint32_t(min_views)) {
+                return;
+            }
+            voxel_at[acc.first] = int32_t(voxel_pts.size());
+            Eigen::Vector3d c = acc.sum / acc.count;
+            voxel_pts.emplace_back(c[0], c[1], c[2]);
+        });
+    }
+
+    kept.points.reserve(voxel_pts.size());
+    for (std::size_t i = 0; i < n; i++) {
+        if (voxel_at[i] >= 0) {
+            kept.points.push_back(voxel_pts[voxel_at[i]]);
+        }
+    }
+    kept.width = kept.points.size();
+    kept.height = 1;
+    kept.is_dense = true;
+    LOG_DEBUG("voxel merge: {} points in {} voxels, {} seen by at least {} views", n, voxels, kept.size(),
+              min_views);
+    return kept;
+}
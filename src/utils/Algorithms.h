@@ -6,6 +6,7 @@
 #include <pcl/ModelCoefficients.h>
 #include <librealsense2/rs.hpp>
 #include <librealsense2/rsutil.h>
+#include <limits>
 
 namespace camera {
     class intrinsics;
@@ -58,7 +59,7 @@ namespace algos {
      * @param cloud calibration.
      * @param plane plane.
      * @param delta error threshold for finding the point.
-     * @return point in the plane or point of 0,0,0.
+     * @return point closest to the plane within delta or point of 0,0,0.
      */
     pcl::PointXYZ find_point_in_plane(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
                                       const equations::Plane &plane,
@@ -76,6 +77,46 @@ namespace algos {
                               const equations::Plane &plane,
                               double delta);
 
+    /**
+     * Points near a plane found by query_plane_points.
+     */
+    struct PlanePointQuery {
+        bool found = false;
+        pcl::PointXYZ best_inlier;            /** inlier closest to the plane */
+        double best_distance = 0;             /** its signed distance */
+        pcl::PointXYZ least_squares_point;    /** centroid of the inliers, the plane with the same normal that fits
+                                                  them best passes through it */
+        std::size_t inliers = 0;
+        double mean_distance = 0;             /** signed, shows how far the plane offset is off */
+        double rms_distance = 0;
+        double max_abs_distance = 0;
+    };
+
+    /**
+     * Signed distance of every point to the plane in one pass. The points are read in place as a 4 x n
+     * matrix and only its x, y, z rows are multiplied, so each chunk is a single vectorized matrix product
+     * whatever the padding holds. NaN points get NaN distances.
+     *
+     * @param cloud points.
+     * @param plane plane, the normal doesn't have to be unit length.
+     * @param distances resized to the cloud size.
+     */
+    void plane_signed_distances(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                const equations::Plane &plane,
+                                std::vector<float> &distances);
+
+    /**
+     * Collect every point within delta of the plane across the clouds.
+     *
+     * @param clouds clouds to search.
+     * @param plane plane.
+     * @param delta distance threshold.
+     * @return best inlier, least squares point and statistics, found is false without inliers.
+     */
+    PlanePointQuery query_plane_points(const std::vector<std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>> &clouds,
+                                       const equations::Plane &plane,
+                                       double delta);
+
 
     /**
      * Rotate a point calibration about a line.
@@ -120,6 +161,14 @@ namespace algos {
     rotate_cloud_about_z_axis(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
                               float theta);
 
+    /**
+     * Matrix of the rotation rotate_cloud_about_z_axis applies, handy as a turntable prior for registration.
+     *
+     * @param theta rotation degree, the matrix rotates by -theta like rotate_cloud_about_z_axis.
+     * @return 4x4 homogeneous rotation about the z-axis.
+     */
+    Eigen::Matrix4f z_rotation_matrix(float theta);
+
     /**
      * Calculate the transformation matrix from center of turntable to origin (0,0,0).
      *
@@ -138,6 +187,128 @@ namespace algos {
                                   const equations::Normal &ground_normal);
 
 
+    /**
+     * Remove the turntable surface, everything under it and everything outside the bed in one vectorized pass,
+     * straight from the calibrated plane and axis instead of a crop box or a RANSAC fit. Removed points become
+     * NaN so an organized cloud stays organized.
+     * A point is kept if its signed height h = axis . (p - origin) above the surface is in
+     * (surface_offset, max_height] and its distance from the axis is at most diameter / 2.
+     *
+     * @param cloud cloud to filter in place.
+     * @param origin center of the turntable surface, e.g. the calibrated origin_point.
+     * @param axis unit rotation axis pointing up from the surface, e.g. the calibrated axis_direction.
+     * @param diameter turntable diameter, usually constants::BED_DIAMETER.
+     * @param surface_offset points up to this high are still turntable.
+     * @param max_height points above this are dropped too.
+     * @return number of finite points removed.
+     */
+    std::size_t remove_turntable(pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                 const Eigen::Vector3f &origin,
+                                 const Eigen::Vector3f &axis,
+                                 float diameter,
+                                 float surface_offset,
+                                 float max_height = std::numeric_limits<float>::infinity());
+
+    /**
+     * How a voxel picks its representative point when downsampling.
+     * CENTROID = average of every point in the voxel.
+     * FIRST_POINT = the point with the lowest index in the voxel, keeps real measurements.
+     */
+    enum class VoxelPolicy {
+        CENTROID,
+        FIRST_POINT
+    };
+
+    /**
+     * Downsample a cloud with a sparse hashed voxel grid.
+     * Unlike pcl::VoxelGrid there is no dense index over the bounding box, so tiny leaves over large
+     * extents are fine. Runs in O(n) time and memory on every core and the output order is deterministic
+     * (voxels are ordered by their first point).
+     *
+     * @param cloud cloud to downsample, NaN points are ignored.
+     * @param leaf_size edge length of a voxel.
+     * @param policy how each voxel picks its output point.
+     * @return unorganized downsampled cloud with the header and sensor pose of the input.
+     * @throws invalid_argument if leaf_size is not positive or the cloud spans more than 2^21 voxels on an axis.
+     */
+    pcl::PointCloud<pcl::PointXYZ>
+    voxel_hash_downsample(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud,
+                          float leaf_size,
+                          VoxelPolicy policy = VoxelPolicy::CENTROID);
+
+    /**
+     * Estimate normals straight from the pixel grid of an organized cloud, no neighbor search.
+     * Each normal is the cross product of the horizontal and vertical differences step pixels apart, using
+     * one sided differences next to holes and borders. Rows run in parallel.
+     *
+     * @param cloud organized cloud, e.g. straight from the depth frame or after a crop that kept it organized.
+     * @param step pixel distance of the neighbors, bigger is smoother.
+     * @param max_edge neighbors further than this (meters) are across a depth jump and not used.
+     * @return normals in the same grid, NaN where there wasn't enough valid neighborhood.
+     * @throws invalid_argument if the cloud isn't organized.
+     */
+    pcl::PointCloud<pcl::Normal> estimate_organized_normals(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                                            int step = 2,
+                                                            float max_edge = .01);
+
+    /**
+     * Smoother organized normals from integral images of the pixel grid (average 3D gradient).
+     * The horizontal gradient is the mean of the window right of a pixel minus the mean of the window left of
+     * it, the vertical one likewise, and the normal is their cross product. Box sums come from integral
+     * images, so the cost doesn't depend on the window. A radius of 3 averages 7x7 = 49 pixels, about what a
+     * K = 50 neighbor search does, without any tree. Rows and columns run in parallel.
+     *
+     * @param cloud organized cloud.
+     * @param radius half size of the averaging window in pixels.
+     * @param max_edge a side window whose mean is further than this (meters) from the pixel is across a depth
+     * jump and replaced by the pixel itself.
+     * @return normals in the same grid, NaN where there wasn't enough valid neighborhood.
+     * @throws invalid_argument if the cloud isn't organized or radius < 1.
+     */
+    pcl::PointCloud<pcl::Normal> estimate_integral_normals(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                                           int radius = 3,
+                                                           float max_edge = .01);
+
+    /**
+     * Transform every cloud and concatenate them into one cloud with a single allocation.
+     * The output is sized up front from the finite point counts, then each cloud's chunks transform straight
+     * into their slice in parallel. Points keep their order, view by view.
+     *
+     * @param clouds clouds to merge, NaN points are dropped.
+     * @param poses one transform per cloud.
+     * @param view_offsets optional output, points of cloud v are [view_offsets[v], view_offsets[v + 1]) in the
+     * merged cloud.
+     * @return unorganized dense merged cloud.
+     * @throws invalid_argument if the number of poses doesn't match the number of clouds.
+     */
+    pcl::PointCloud<pcl::PointXYZ>
+    merge_transformed_clouds(const std::vector<std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>> &clouds,
+                             const std::vector<Eigen::Matrix4f> &poses,
+                             std::vector<std::size_t> *view_offsets = nullptr);
+
+    /**
+     * Merge registered views and collapse their overlap on a sparse hashed voxel grid.
+     * Every voxel becomes the centroid of its points and remembers how many distinct views hit it, voxels
+     * seen by fewer than min_views views are dropped. Overlapping views turn into one point per surface
+     * voxel and stray points only one view saw disappear, in O(n) with no neighbor search, so it replaces
+     * concatenating and running statistical outlier removal over the whole merged cloud.
+     * Same sharded accumulation as voxel_hash_downsample, the output is deterministic and ordered by the
+     * first point of each voxel.
+     *
+     * @param clouds views to merge, NaN points are ignored.
+     * @param poses one transform per view.
+     * @param leaf_size edge length of a voxel, around the sensor noise.
+     * @param min_views views that must see a voxel for it to be kept, 1 keeps everything.
+     * @return unorganized dense merged cloud.
+     * @throws invalid_argument if the poses don't match the clouds, min_views < 1, or the leaf size is not
+     * positive or too small for the extent.
+     */
+    pcl::PointCloud<pcl::PointXYZ>
+    merge_views_voxel_hash(const std::vector<std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>>> &clouds,
+                           const std::vector<Eigen::Matrix4f> &poses,
+                           float leaf_size,
+                           int min_views = 2);
+
     /**
      * Given a vector of planes, average them.
      *
@@ -0,0 +1,65 @@
+#include "DepthBackground.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <stdexcept>
+
+std::vector<uint16_t> algos::fuse_depth_frames(const std::vector<std::vector<uint16_t>> &frames, int min_valid) {
+    if (frames.empty()) {
+        throw std::invalid_argument("need at least one depth frame to fuse");
+    }
+    const std::size_t pixels = frames[0].size();
+    for (const auto &frame : frames) {
+        if (frame.size() != pixels) {
+            throw std::invalid_argument("depth frames to fuse must all have the same size");
+        }
+    }
+    const std::size_t needed = std::max(min_valid, 1);
+    std::vector<uint16_t> fused(pixels, 0);
+    parallel::for_each_range(pixels, 1 << 14, [&](std::size_t begin, std::size_t end) {
+        std::vector<uint16_t> samples;
+        samples.reserve(frames.size());
+        for (std::size_t i = begin; i < end; i++) {
+            samples.clear();
+            for (const auto &frame : frames) {
+                if (frame[i] != 0) {
+                    samples.push_back(frame[i]);
+                }
+            }
+            if (samples.size() < needed) {
+                continue;
+            }
+            auto mid = samples.begin() + samples.size() / 2;
+            std::nth_element(samples.begin(), mid, samples.end());
+            fused[i] = *mid;
+        }
+    });
+    return fused;
+}
+
+std::size_t algos::subtract_depth_background(std::vector<uint16_t> &depth,
+                                             const std::vector<uint16_t> &background,
+                                             uint16_t margin) {
+    if (depth.size() != background.size()) {
+        throw std::invalid_argument("depth frame and background differ in size, was the background captured "
+                                    "with another resolution?");
+    }
+    const std::size_t grain = 1 << 15;
+    std::vector<std::size_t> chunk_cleared(parallel::num_chunks(depth.size(), grain), 0);
+    parallel::for_each_range(depth.size(), grain, [&](std::size_t begin, std::size_t end) {
+        std::size_t cleared = 0;
+        // branch free so the loop vectorizes
+        for (std::size_t i = begin; i < end; i++) {
+            const uint32_t d = depth[i];
+            const uint32_t b = background[i];
+            const bool behind = b != 0 && d + margin >= b;
+            cleared += behind && d != 0;
+            depth[i] = behind ? 0 : d;
+        }
+        chunk_cleared[begin / grain] = cleared;
+    });
+    std::size_t cleared = 0;
+    for (std::size_t c : chunk_cleared) {
+        cleared += c;
+    }
+    return cleared;
+}
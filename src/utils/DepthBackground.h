@@ -0,0 +1,36 @@
+#ifndef SWAG_SCANNER_DEPTHBACKGROUND_H
+#define SWAG_SCANNER_DEPTHBACKGROUND_H
+
+#include <cstdint>
+#include <vector>
+
+namespace algos {
+
+    /**
+     * Fuse depth frames of a static scene into one image. Every pixel gets the median of the frames that
+     * measured it, which drops the flicker and speckle of single frames.
+     *
+     * @param frames depth frames of the same size, 0 means no measurement.
+     * @param min_valid pixels measured in fewer frames than this stay 0.
+     * @return fused depth image.
+     * @throws invalid_argument if there are no frames or their sizes differ.
+     */
+    std::vector<uint16_t> fuse_depth_frames(const std::vector<std::vector<uint16_t>> &frames, int min_valid = 1);
+
+    /**
+     * Keep only what is in front of the background. A pixel is cleared (set to 0) unless it is at least
+     * margin closer than the background there. Pixels without background depth are kept.
+     * Runs on the depth image before deprojection, create_point_cloud turns the cleared pixels into NaN points.
+     *
+     * @param depth live depth frame, filtered in place.
+     * @param background fused background of the same size.
+     * @param margin depth units a pixel has to be in front of the background.
+     * @return number of measured pixels that were cleared.
+     * @throws invalid_argument if the sizes differ.
+     */
+    std::size_t subtract_depth_background(std::vector<uint16_t> &depth,
+                                          const std::vector<uint16_t> &background,
+                                          uint16_t margin);
+}
+
+#endif //SWAG_SCANNER_DEPTHBACKGROUND_H
@@ -3,86 +3,322 @@
 #define SWAG_SCANNER_LOGGER_H
 
 
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <vector>
+#include <string>
+#include <utility>
 #include <spdlog/spdlog.h>
+#include <spdlog/fmt/fmt.h>
 #include <spdlog/async.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/sinks/basic_file_sink.h>
 #include <spdlog/sinks/stdout_sinks.h>
-#include <spdlog/sinks/dist_sink.h>
+#include <spdlog/sinks/base_sink.h>
 
 namespace logger {
 
-    static std::shared_ptr<spdlog::details::thread_pool> _tp = std::make_shared<spdlog::details::thread_pool>(51200, 4);
-    static auto dist_sink = std::make_shared<spdlog::sinks::dist_sink_mt>(
-            std::vector<spdlog::sink_ptr>({}));
+    /**
+     * Queue and worker behind the file logger. One worker so messages reach the file in the order they
+     * were logged. inline so every translation unit shares the same pool and sink.
+     */
+    inline std::shared_ptr<spdlog::details::thread_pool> _tp = std::make_shared<spdlog::details::thread_pool>(51200, 1);
+
+    namespace detail {
+        /**
+         * Name of the logger whose messages tell switching_file_sink to move on to its next file.
+         */
+        inline constexpr const char *SWITCH_LOGGER_NAME = "log_switch";
+
+        /**
+         * Sink that forwards to one file at a time. Switching is a message on the same queue as everything
+         * else, so the worker moves to the next file exactly between the messages queued before and after it.
+         */
+        class switching_file_sink : public spdlog::sinks::base_sink<std::mutex> {
+        public:
+            /**
+             * Queue the file the next switch message moves to.
+             */
+            void queue_file(spdlog::sink_ptr file) {
+                std::lock_guard<std::mutex> lock(pending_mtx);
+                pending.push_back(std::move(file));
+            }
+
+        protected:
+            void sink_it_(const spdlog::details::log_msg &msg) override {
+                if (msg.logger_name == SWITCH_LOGGER_NAME) {
+                    std::lock_guard<std::mutex> lock(pending_mtx);
+                    if (!pending.empty()) {
+                        if (file != nullptr) {
+                            file->flush();
+                        }
+                        file = std::move(pending.front());
+                        pending.pop_front();
+                    }
+                    return;
+                }
+                if (file != nullptr) {
+                    file->log(msg);
+                }
+            }
+
+            void flush_() override {
+                if (file != nullptr) {
+                    file->flush();
+                }
+            }
+
+        private:
+            spdlog::sink_ptr file;
+            std::mutex pending_mtx;
+            std::deque<spdlog::sink_ptr> pending;
+        };
+    }
+
+    inline auto file_sink = std::make_shared<detail::switching_file_sink>();
+
+    namespace detail {
+        /**
+         * Owners of the two loggers, written once at startup by the setup functions.
+         */
+        inline std::shared_ptr<spdlog::logger> default_owner;
+        inline std::shared_ptr<spdlog::logger> file_owner;
 
+        /**
+         * Raw handles read on every message, so logging never goes through the spdlog registry mutex.
+         */
+        inline std::atomic<spdlog::logger *> default_handle{nullptr};
+        inline std::atomic<spdlog::logger *> file_handle{nullptr};
+
+        /**
+         * Path of the file file_sink writes to once the queued switches are done.
+         */
+        inline std::mutex file_path_mtx;
+        inline std::string file_path;
+
+        /**
+         * Posts the switch messages to the file logger's queue. Blocks instead of dropping when the queue is
+         * full, a lost switch would leave the old file open.
+         */
+        inline std::shared_ptr<spdlog::logger> switch_owner;
+    }
 
     inline std::shared_ptr<spdlog::logger> setup_default_logger() {
-        auto default_logger = spdlog::stdout_logger_mt("default_logger");
-        return default_logger;
+        if (detail::default_owner == nullptr) {
+            detail::default_owner = spdlog::stdout_logger_mt("default_logger");
+            detail::default_handle.store(detail::default_owner.get());
+        }
+        return detail::default_owner;
     }
 
 
-    inline std::shared_ptr<spdlog::logger> setup_file_logger() {
-        auto logger = std::make_shared<spdlog::logger>("backend_logger",
-                                                       dist_sink);
+    /**
+     * Parse the "log_overflow_policy" value from config.json. "block" makes callers wait when the queue is
+     * full, "overrun_oldest" drops the oldest queued messages instead so hot threads never stall.
+     */
+    inline spdlog::async_overflow_policy parse_overflow_policy(const std::string &name) {
+        if (name == "overrun_oldest") {
+            return spdlog::async_overflow_policy::overrun_oldest;
+        }
+        return spdlog::async_overflow_policy::block;
+    }
+
+    /**
+     * Create the async file logger, or return it if it already exists. Messages are formatted on the calling
+     * thread and written to disk by the _tp worker. The logger is registered with spdlog so flush_every()
+     * and spdlog::get("backend_logger") see it.
+     *
+     * @param policy what to do when the queue is full.
+     * @param flush_interval_s seconds between periodic flushes, errors are always flushed right away.
+     */
+    inline std::shared_ptr<spdlog::logger> setup_file_logger(
+            spdlog::async_overflow_policy policy = spdlog::async_overflow_policy::block,
+            int flush_interval_s = 3) {
+        if (detail::file_owner != nullptr) {
+            return detail::file_owner;
+        }
+        auto logger = std::make_shared<spdlog::async_logger>("backend_logger",
+                                                             file_sink, _tp, policy);
         // [Oct 20 2020] some logging message
-        logger->flush_on(spdlog::level::info);
+        logger->flush_on(spdlog::level::err);
 //            logger->set_pattern("[%b %d %Y] %v");
+        spdlog::register_logger(logger);
+        spdlog::flush_every(std::chrono::seconds(flush_interval_s));
+        detail::file_owner = logger;
+        detail::file_handle.store(logger.get());
         return logger;
     }
 
     inline std::shared_ptr<spdlog::logger> get_file_logger() {
-        return spdlog::get("backend_logger");
+        return detail::file_owner;
     }
 
     /**
      * Change location of output file of the file logger.
      * Make sure to put the entire path + file.
      * Example: "/user/files/swagscanner/scans/scan1/info/basic_logger.txt"
-     * Note: may exist a better way to do this, kinda inefficient to keep spawning new sinks.
+     * Does nothing if the logger already writes there, file handlers call this every time they're built.
+     * The file is opened here, the switch itself is queued behind the messages logged so far and done by
+     * the logger's worker, so this never waits for the queue. Everything logged before the call goes to the
+     * old file and everything logged after it returns to the new one, messages other threads log during the
+     * call land on the side of the switch they were queued on.
      *
      * @param path full path to the new log text file.
      */
     inline void set_file_logger_location(const std::string &path) {
-        auto new_sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(path);
-        dist_sink->set_sinks(std::vector<spdlog::sink_ptr>({new_sink}));
+        std::lock_guard<std::mutex> lock(detail::file_path_mtx);
+        if (path == detail::file_path) {
+            return;
+        }
+        if (detail::switch_owner == nullptr) {
+            detail::switch_owner = std::make_shared<spdlog::async_logger>(
+                    detail::SWITCH_LOGGER_NAME, file_sink, _tp, spdlog::async_overflow_policy::block);
+            detail::switch_owner->set_level(spdlog::level::trace);
+        }
+        file_sink->queue_file(std::make_shared<spdlog::sinks::basic_file_sink_mt>(path));
+        detail::switch_owner->log(spdlog::level::info, path);
+        detail::file_path = path;
     }
 
     /**
-     * Write an info level message. Write to both file and console. If the file sink hasn't been set up,
+     * Messages held back on one thread, see LogCapture.
+     */
+    using LogBuffer = std::vector<std::pair<spdlog::level::level_enum, std::string>>;
+
+    namespace detail {
+        inline thread_local LogBuffer *capture = nullptr;
+    }
+
+    /**
+     * While alive, every message written on the constructing thread goes into the given buffer instead of
+     * the loggers. Use it on worker threads and replay() the buffers in a fixed order afterwards so parallel
+     * work still produces a deterministic log.
+     */
+    class LogCapture {
+    public:
+        explicit LogCapture(LogBuffer &buffer) : previous(detail::capture) {
+            detail::capture = &buffer;
+        }
+
+        ~LogCapture() {
+            detail::capture = previous;
+        }
+
+        LogCapture(const LogCapture &) = delete;
+
+        LogCapture &operator=(const LogCapture &) = delete;
+
+    private:
+        LogBuffer *previous;
+    };
+
+    /**
+     * @return true if either logger would emit a message at this level.
+     */
+    inline bool should_log(spdlog::level::level_enum level) {
+        spdlog::logger *default_logger = detail::default_handle.load(std::memory_order_acquire);
+        spdlog::logger *file_logger = detail::file_handle.load(std::memory_order_acquire);
+        return (default_logger != nullptr && default_logger->should_log(level)) ||
+               (file_logger != nullptr && file_logger->should_log(level));
+    }
+
+    /**
+     * Write a message at the given level to both file and console. If the file sink hasn't been set up,
      * then only write to console.
+     * @param level spdlog level.
      * @param message message you want to write.
      */
-    inline void info(const std::string &message) {
-        auto default_logger = spdlog::get("default_logger");
-        auto file_logger = spdlog::get("backend_logger");
+    inline void log(spdlog::level::level_enum level, const std::string &message) {
+        if (detail::capture != nullptr) {
+            detail::capture->emplace_back(level, message);
+            return;
+        }
+        spdlog::logger *file_logger = detail::file_handle.load(std::memory_order_acquire);
         if (file_logger != nullptr) {
-            file_logger->info(message);
+            file_logger->log(level, message);
+        }
+        spdlog::logger *default_logger = detail::default_handle.load(std::memory_order_acquire);
+        if (default_logger != nullptr) {
+            default_logger->log(level, message);
         }
-        default_logger->info(message);
     }
 
-    inline void debug(const std::string &message) {
-        auto default_logger = spdlog::get("default_logger");
-        auto file_logger = spdlog::get("backend_logger");
-        if (file_logger != nullptr) {
-            file_logger->debug(message);
+    /**
+     * fmt style version of log(). The message is only formatted if some logger wants this level.
+     * Use it through the LOG_* macros so levels below SWAG_LOG_ACTIVE_LEVEL are compiled out.
+     *
+     * @param level spdlog level.
+     * @param format fmt format string, e.g. "removed {} points".
+     * @param args format arguments.
+     */
+    template<typename... Args>
+    inline void logf(spdlog::level::level_enum level, const char *format, Args &&... args) {
+        if (detail::capture == nullptr && !should_log(level)) {
+            return;
         }
-        default_logger->debug(message);
+        log(level, fmt::format(format, std::forward<Args>(args)...));
     }
 
-    inline void error(const std::string &message) {
-        auto default_logger = spdlog::get("default_logger");
-        auto file_logger = spdlog::get("backend_logger");
-        if (file_logger != nullptr) {
-            file_logger->error(message);
+    /**
+     * Write out messages that were captured on another thread, in the order they were captured.
+     * @param buffer captured messages.
+     */
+    inline void replay(const LogBuffer &buffer) {
+        for (const auto &m : buffer) {
+            log(m.first, m.second);
         }
-        default_logger->error(message);
+    }
+
+    /**
+     * Write an info level message. Write to both file and console. If the file sink hasn't been set up,
+     * then only write to console.
+     * @param message message you want to write.
+     */
+    inline void info(const std::string &message) {
+        log(spdlog::level::info, message);
+    }
+
+    inline void debug(const std::string &message) {
+        log(spdlog::level::debug, message);
+    }
+
+    inline void error(const std::string &message) {
+        log(spdlog::level::err, message);
     }
 
 }
 
+/**
+ * Compile time floor for the LOG_* macros, uses the SPDLOG_LEVEL_* values (0 trace ... 6 off).
+ * Set it with -DSWAG_LOG_ACTIVE_LEVEL in cmake, calls below it are removed along with their arguments.
+ */
+#ifndef SWAG_LOG_ACTIVE_LEVEL
+#define SWAG_LOG_ACTIVE_LEVEL SPDLOG_LEVEL_DEBUG
+#endif
+
+// the level check comes first so disabled calls don't even evaluate their arguments
+#define SWAG_LOG_CALL(level, ...) \
+    ((logger::detail::capture != nullptr || logger::should_log(level)) ? logger::logf(level, __VA_ARGS__) : (void)0)
+
+#if SWAG_LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) SWAG_LOG_CALL(spdlog::level::debug, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) (void)0
+#endif
+
+#if SWAG_LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_INFO
+#define LOG_INFO(...) SWAG_LOG_CALL(spdlog::level::info, __VA_ARGS__)
+#else
+#define LOG_INFO(...) (void)0
+#endif
+
+#if SWAG_LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_ERROR
+#define LOG_ERROR(...) SWAG_LOG_CALL(spdlog::level::err, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) (void)0
+#endif
+
 #endif //SWAG_SCANNER_LOGGER_H
@@ -0,0 +1,285 @@
+#include "MortonOrder.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace {
+    const std::size_t GRAIN = 1 << 16;
+
+    /**
+     * Code NaN points sort under, above every real code and only one byte away from them.
+     */
+    const uint64_t NAN_CODE = 1ull << 63;
+
+    uint64_t spread_bits(uint32_t v) {
+        uint64_t x = v & ((1u << algos::MORTON_BITS) - 1);
+        x = (x | x << 32) & 0x1f00000000ffffull;
+        x = (x | x << 16) & 0x1f0000ff0000ffull;
+        x = (x | x << 8) & 0x100f00f00f00f00full;
+        x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+        x = (x | x << 2) & 0x1249249249249249ull;
+        return x;
+    }
+
+    uint32_t compact_bits(uint64_t x) {
+        x &= 0x1249249249249249ull;
+        x = (x ^ (x >> 2)) & 0x10c30c30c30c30c3ull;
+        x = (x ^ (x >> 4)) & 0x100f00f00f00f00full;
+        x = (x ^ (x >> 8)) & 0x1f0000ff0000ffull;
+        x = (x ^ (x >> 16)) & 0x1f00000000ffffull;
+        x = (x ^ (x >> 32)) & 0x1fffffull;
+        return uint32_t(x);
+    }
+
+    bool finite(const pcl::PointXYZ &p) {
+        return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+    }
+}
+
+uint64_t algos::morton_encode(uint32_t x, uint32_t y, uint32_t z) {
+    return spread_bits(x) << 2 | spread_bits(y) << 1 | spread_bits(z);
+}
+
+void algos::morton_decode(uint64_t code, uint32_t &x, uint32_t &y, uint32_t &z) {
+    x = compact_bits(code >> 2);
+    y = compact_bits(code >> 1);
+    z = compact_bits(code);
+}
+
+algos::MortonGrid algos::morton_grid(const pcl::PointCloud<pcl::PointXYZ> &cloud) {
+    const auto &pts = cloud.points;
+    const std::size_t chunks = parallel::num_chunks(pts.size(), GRAIN);
+    std::vector<Eigen::Array3f> chunk_min(chunks, Eigen::Array3f::Constant(std::numeric_limits<float>::max()));
+    std::vector<Eigen::Array3f> chunk_max(chunks, Eigen::Array3f::Constant(std::numeric_limits<float>::lowest()));
+    parallel::for_each_range(pts.size(), GRAIN, [&](std::size_t begin, std::size_t end) {
+        Eigen::Array3f lo = chunk_min[begin / GRAIN];
+        Eigen::Array3f hi = chunk_max[begin / GRAIN];
+        for (std::size_t i = begin; i < end; i++) {
+            if (finite(pts[i])) {
+                lo = lo.min(pts[i].getArray3fMap());
+                hi = hi.max(pts[i].getArray3fMap());
+            }
+        }
+        chunk_min[begin / GRAIN] = lo;
+        chunk_max[begin / GRAIN] = hi;
+    });
+    Eigen::Array3f min_pt = Eigen::Array3f::Constant(std::numeric_limits<float>::max());
+    Eigen::Array3f max_pt = Eigen::Array3f::Constant(std::numeric_limits<float>::lowest());
+    for (std::size_t c = 0; c < chunks; c++) {
+        min_pt = min_pt.min(chunk_min[c]);
+        max_pt = max_pt.max(chunk_max[c]);
+    }
+
+    MortonGrid grid;
+    if ((min_pt > max_pt).any()) {
+        return grid;
+    }
+    grid.origin = min_pt.matrix();
+    float extent = (max_pt - min_pt).maxCoeff();
+    if (extent > 0) {
+        grid.cell_size = extent / float((1u << MORTON_BITS) - 1);
+    }
+    return grid;
+}
+
+uint64_t algos::morton_code(const MortonGrid &grid, const pcl::PointXYZ &point) {
+    Eigen::Array3f v = ((point.getArray3fMap() - grid.origin.array()) / grid.cell_size).floor();
+    v = v.min(float((1u << MORTON_BITS) - 1)).max(0.f);
+    return morton_encode(uint32_t(v[0]), uint32_t(v[1]), uint32_t(v[2]));
+}
+
+void algos::radix_sort_keys(std::vector<uint64_t> &keys, std::vector<uint32_t> &order) {
+    const std::size_t n = keys.size();
+    order.resize(n);
+    std::iota(order.begin(), order.end(), 0);
+    if (n < 2) {
+        return;
+    }
+    const std::size_t chunks = parallel::num_chunks(n, GRAIN);
+
+    // bits that differ from the first key, bytes without any are already sorted
+    std::vector<uint64_t> chunk_diff(chunks, 0);
+    parallel::for_each_range(n, GRAIN, [&](std::size_t begin, std::size_t end) {
+        uint64_t diff = 0;
+        for (std::size_t i = begin; i < end; i++) {
+            diff |= keys[i] ^ keys[0];
+        }
+        chunk_diff[begin / GRAIN] = diff;
+    });
+    uint64_t diff = 0;
+    for (uint64_t d : chunk_diff) {
+        diff |= d;
+    }
+
+    std::vector<uint64_t> keys_out(n);
+    std::vector<uint32_t> order_out(n);
+    std::vector<std::array<std::size_t, 256>> offsets(chunks);
+    for (int shift = 0; shift < 64; shift += 8) {
+        if (((diff >> shift) & 0xff) == 0) {
+            continue;
+        }
+        parallel::for_each_range(n, GRAIN, [&](std::size_t begin, std::size_t end) {
+            auto &count = offsets[begin / GRAIN];
+            count.fill(0);
+            for (std::size_t i = begin; i < end; i++) {
+                count[(keys[i] >> shift) & 0xff]++;
+            }
+        });
+        // digit major, chunk minor, so equal digits keep their order
+        std::size_t total = 0;
+        for (std::size_t d = 0; d < 256; d++) {
+            for (std::size_t c = 0; c < chunks; c++) {
+                std::size_t count = offsets[c][d];
+                offsets[c][d] = total;
+                total += count;
+            }
+        }
+        parallel::for_each_range(n, GRAIN, [&](std::size_t begin, std::size_t end) {
+            auto &next = offsets[begin / GRAIN];
+            for (std::size_t i = begin; i < end; i++) {
+                std::size_t out = next[(keys[i] >> shift) & 0xff]++;
+                keys_out[out] = keys[i];
+                order_out[out] = order[i];
+            }
+        });
+        keys.swap(keys_out);
+        order.swap(order_out);
+    }
+}
+
+std::vector<uint32_t> algos::morton_sort(pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                         std::vector<uint64_t> *codes,
+                                         MortonGrid *grid) {
+    const MortonGrid cloud_grid = morton_grid(cloud);
+    const auto &pts = cloud.points;
+    std::vector<uint64_t> keys(pts.size());
+    parallel::for_each_range(pts.size(), GRAIN, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            keys[i] = finite(pts[i]) ? morton_code(cloud_grid, pts[i]) : NAN_CODE;
+        }
+    });
+    std::vector<uint32_t> order;
+    radix_sort_keys(keys, order);
+
+    // NaN points sorted to the back
+    std::size_t kept = std::lower_bound(keys.begin(), keys.end(), NAN_CODE) - keys.begin();
+    keys.resize(kept);
+    order.resize(kept);
+    pcl::PointCloud<pcl::PointXYZ> sorted;
+    sorted.header = cloud.header;
+    sorted.sensor_origin_ = cloud.sensor_origin_;
+    sorted.sensor_orientation_ = cloud.sensor_orientation_;
+    sorted.points.resize(kept);
+    parallel::for_each_range(kept, GRAIN, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t k = begin; k < end; k++) {
+            sorted.points[k] = pts[order[k]];
+        }
+    });
+    sorted.width = kept;
+    sorted.height = 1;
+    sorted.is_dense = true;
+    cloud = std::move(sorted);
+
+    if (codes != nullptr) {
+        *codes = std::move(keys);
+    }
+    if (grid != nullptr) {
+        *grid = cloud_grid;
+    }
+    return order;
+}
+
+algos::MortonOctree::MortonOctree(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud) : cloud(cloud) {
+    morton_sort(*cloud, &codes, &grid);
+}
+
+std::pair<std::size_t, std::size_t> algos::MortonOctree::node_range(int level, uint64_t node) const {
+    const int shift = 3 * (MORTON_BITS - level);
+    auto begin = std::lower_bound(codes.begin(), codes.end(), node << shift);
+    auto end = std::lower_bound(begin, codes.end(), (node + 1) << shift);
+    return {std::size_t(begin - codes.begin()), std::size_t(end - codes.begin())};
+}
+
+std::vector<int> algos::MortonOctree::box_query(const Eigen::Vector3f &min, const Eigen::Vector3f &max) const {
+    std::vector<int> out;
+    box_query(0, 0, 0, codes.size(), min.array(), max.array(), out);
+    return out;
+}
+
+std::vector<int> algos::MortonOctree::lod_indices(int level) const {
+    const int shift = 3 * (MORTON_BITS - std::max(0, std::min(level, MORTON_BITS)));
+    std::vector<int> out;
+    std::size_t i = 0;
+    while (i < codes.size()) {
+        out.push_back(int(i));
+        uint64_t next_node = ((codes[i] >> shift) + 1) << shift;
+        i = std::lower_bound(codes.begin() + i, codes.end(), next_node) - codes.begin();
+    }
+    return out;
+}
+
+int algos::MortonOctree::level_for_size(float size) const {
+    if (!(size > grid.cell_size)) {
+        return MORTON_BITS;
+    }
+    int above_cell = int(std::ceil(std::log2(size / grid.cell_size)));
+    return std::max(0, MORTON_BITS - above_cell);
+}
+
+const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &algos::MortonOctree::get_cloud() const {
+    return cloud;
+}
+
+const std::vector<uint64_t> &algos::MortonOctree::get_codes() const {
+    return codes;
+}
+
+const algos::MortonGrid &algos::MortonOctree::get_grid() const {
+    return grid;
+}
+
+void algos::MortonOctree::box_query(int level, uint64_t node, std::size_t begin, std::size_t end,
+                                    const Eigen::Array3f &min, const Eigen::Array3f &max,
+                                    std::vector<int> &out) const {
+    if (begin == end) {
+        return;
+    }
+    uint32_t x, y, z;
+    morton_decode(node, x, y, z);
+    const float size = grid.cell_size * float(1u << (MORTON_BITS - level));
+    const Eigen::Array3f lo = grid.origin.array() + Eigen::Array3f(x, y, z) * size;
+    const Eigen::Array3f hi = lo + size;
+    if ((hi < min).any() || (lo > max).any()) {
+        return;
+    }
+    const auto &pts = cloud->points;
+    // a cell of slack, so rounding in the cell math never lets a point just outside the box in
+    if ((lo - grid.cell_size >= min).all() && (hi + grid.cell_size <= max).all()) {
+        for (std::size_t i = begin; i < end; i++) {
+            out.push_back(int(i));
+        }
+        return;
+    }
+    if (level == MORTON_BITS || end - begin <= 32) {
+        for (std::size_t i = begin; i < end; i++) {
+            const Eigen::Array3f p = pts[i].getArray3fMap();
+            if ((p >= min).all() && (p <= max).all()) {
+                out.push_back(int(i));
+            }
+        }
+        return;
+    }
+    // children are consecutive runs inside the node, split them with binary searches
+    const int shift = 3 * (MORTON_BITS - level - 1);
+    std::size_t child_begin = begin;
+    for (uint64_t c = 0; c < 8; c++) {
+        const uint64_t child = node << 3 | c;
+        std::size_t child_end = std::lower_bound(codes.begin() + child_begin, codes.begin() + end,
+                                                 (child + 1) << shift) - codes.begin();
+        box_query(level + 1, child, child_begin, child_end, min, max, out);
+        child_begin = child_end;
+    }
+}
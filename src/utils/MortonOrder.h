@@ -0,0 +1,126 @@
+#ifndef SWAG_SCANNER_MORTONORDER_H
+#define SWAG_SCANNER_MORTONORDER_H
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+namespace algos {
+
+    /**
+     * Bits per axis of a Morton code, 3 * 21 = 63 bits.
+     */
+    inline constexpr int MORTON_BITS = 21;
+
+    /**
+     * Interleave the bits of three cell coordinates, x highest. Coordinates must be < 2^21.
+     * Sorting by the code walks the cells along a Z shaped curve, so points close in space end up close in
+     * memory, and every octree node is one contiguous run of codes.
+     */
+    uint64_t morton_encode(uint32_t x, uint32_t y, uint32_t z);
+
+    /**
+     * Inverse of morton_encode.
+     */
+    void morton_decode(uint64_t code, uint32_t &x, uint32_t &y, uint32_t &z);
+
+    /**
+     * Cube of 2^21 cells per axis over which Morton codes are computed.
+     */
+    struct MortonGrid {
+        Eigen::Vector3f origin = Eigen::Vector3f::Zero();
+        float cell_size = 1;
+    };
+
+    /**
+     * Smallest cube grid that holds every finite point of the cloud.
+     */
+    MortonGrid morton_grid(const pcl::PointCloud<pcl::PointXYZ> &cloud);
+
+    /**
+     * Morton code of a finite point, clamped to the grid.
+     */
+    uint64_t morton_code(const MortonGrid &grid, const pcl::PointXYZ &point);
+
+    /**
+     * Stable parallel LSD radix sort of 64 bit keys, one byte per pass. Bytes that are the same in every key
+     * are skipped, so clouds with a small extent need fewer passes. Every pass histograms fixed chunks on the
+     * default pool and scatters them at offsets taken in digit then chunk order, which keeps the sort stable
+     * and independent of the number of threads.
+     *
+     * @param keys keys to sort in place.
+     * @param order set to the position every sorted key had before sorting.
+     */
+    void radix_sort_keys(std::vector<uint64_t> &keys, std::vector<uint32_t> &order);
+
+    /**
+     * Put a cloud in Morton order. NaN points are dropped and the cloud becomes unorganized.
+     *
+     * @param cloud cloud to reorder in place.
+     * @param codes optional output, sorted Morton code of every point.
+     * @param grid optional output, grid the codes were computed on.
+     * @return index every point had before sorting, e.g. to carry normals along.
+     */
+    std::vector<uint32_t> morton_sort(pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                      std::vector<uint64_t> *codes = nullptr,
+                                      MortonGrid *grid = nullptr);
+
+    /**
+     * Octree over a cloud in Morton order with no nodes of its own. A node at level L (0 is the root, 21 a
+     * single cell) is the run of points whose codes share their first 3 * L bits, found by binary search,
+     * so the whole index is the sorted codes.
+     * Queries are const and safe from many threads.
+     */
+    class MortonOctree {
+    public:
+        /**
+         * Sort the cloud into Morton order in place (dropping NaN points) and index it.
+         * The cloud must not be modified while the octree holds it.
+         */
+        explicit MortonOctree(const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &cloud);
+
+        /**
+         * Points of a node, as [begin, end) indices into the sorted cloud.
+         *
+         * @param level depth of the node, 0 to MORTON_BITS.
+         * @param node first 3 * level bits of the codes under the node.
+         */
+        std::pair<std::size_t, std::size_t> node_range(int level, uint64_t node) const;
+
+        /**
+         * Indices of the points inside an axis aligned box, in Morton order. Nodes fully inside the box are
+         * taken whole, only points of nodes crossing the border are tested.
+         */
+        std::vector<int> box_query(const Eigen::Vector3f &min, const Eigen::Vector3f &max) const;
+
+        /**
+         * Level of detail: the first point of every occupied node at a level, in Morton order.
+         * Costs O(nodes log n), coarse levels of big clouds are cheap enough to redo on every redraw.
+         */
+        std::vector<int> lod_indices(int level) const;
+
+        /**
+         * Finest level at which nodes are at least this big.
+         */
+        int level_for_size(float size) const;
+
+        const std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> &get_cloud() const;
+
+        const std::vector<uint64_t> &get_codes() const;
+
+        const MortonGrid &get_grid() const;
+
+    private:
+        std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> cloud;
+        std::vector<uint64_t> codes;
+        MortonGrid grid;
+
+        void box_query(int level, uint64_t node, std::size_t begin, std::size_t end,
+                       const Eigen::Array3f &min, const Eigen::Array3f &max, std::vector<int> &out) const;
+    };
+}
+
+#endif //SWAG_SCANNER_MORTONORDER_H
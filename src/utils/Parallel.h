@@ -0,0 +1,161 @@
+#ifndef SWAG_SCANNER_PARALLEL_H
+#define SWAG_SCANNER_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/**
+ * Small threading toolkit for the processing hot paths.
+ * Everything funnels through one shared pool so we never oversubscribe the machine.
+ */
+namespace parallel {
+
+    /**
+     * Fixed size pool of worker threads pulling tasks off a FIFO queue.
+     */
+    class ThreadPool {
+    public:
+        /**
+         * Spin up the workers.
+         *
+         * @param num_threads number of workers, 0 means one per hardware thread.
+         */
+        explicit ThreadPool(unsigned int num_threads = 0);
+
+        /**
+         * Drains the queue and joins every worker.
+         */
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        /**
+         * Queue a task. Tasks run in submission order when the pool has one worker.
+         *
+         * @param task task to run.
+         */
+        void submit(std::function<void()> task);
+
+        /**
+         * @return number of worker threads.
+         */
+        unsigned int size() const;
+
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> tasks;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool stopping = false;
+
+        void worker_loop();
+    };
+
+    /**
+     * Process wide pool sized to the hardware.
+     */
+    ThreadPool &default_pool();
+
+    /**
+     * Run f(i) for every i in [0, n) on the default pool. The calling thread works too, and indices
+     * are handed out one at a time from a shared counter so uneven tasks balance themselves.
+     * Safe to nest: an inner call never waits on a worker that is busy with the outer one.
+     * The first exception thrown by f is rethrown on the calling thread once every index is done.
+     *
+     * @param n number of indices.
+     * @param f callable taking a size_t index.
+     */
+    template<typename F>
+    void for_each_index(std::size_t n, F &&f) {
+        if (n == 0) {
+            return;
+        }
+        if (n == 1) {
+            f(std::size_t(0));
+            return;
+        }
+
+        struct State {
+            std::function<void(std::size_t)> fn;
+            std::size_t n;
+            std::atomic<std::size_t> next{0};
+            std::atomic<std::size_t> done{0};
+            std::mutex mtx;
+            std::condition_variable cv;
+            std::exception_ptr error;
+        };
+        auto state = std::make_shared<State>();
+        state->fn = std::ref(f);
+        state->n = n;
+
+        auto work = [state]() {
+            std::size_t i;
+            while ((i = state->next.fetch_add(1)) < state->n) {
+                try {
+                    state->fn(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(state->mtx);
+                    if (!state->error) {
+                        state->error = std::current_exception();
+                    }
+                }
+                if (state->done.fetch_add(1) + 1 == state->n) {
+                    std::lock_guard<std::mutex> lock(state->mtx);
+                    state->cv.notify_all();
+                }
+            }
+        };
+
+        ThreadPool &pool = default_pool();
+        std::size_t helpers = std::min<std::size_t>(pool.size(), n - 1);
+        for (std::size_t k = 0; k < helpers; k++) {
+            pool.submit(work);
+        }
+        work();
+
+        std::unique_lock<std::mutex> lock(state->mtx);
+        state->cv.wait(lock, [&state]() { return state->done.load() == state->n; });
+        if (state->error) {
+            std::rethrow_exception(state->error);
+        }
+    }
+
+    /**
+     * Split [0, n) into contiguous chunks of at most grain elements and run f(begin, end) on each chunk
+     * in parallel. Chunk boundaries only depend on n and grain, so per-chunk results are reproducible.
+     *
+     * @param n number of elements.
+     * @param grain chunk size.
+     * @param f callable taking (size_t begin, size_t end).
+     */
+    template<typename F>
+    void for_each_range(std::size_t n, std::size_t grain, F &&f) {
+        grain = std::max<std::size_t>(grain, 1);
+        std::size_t num_chunks = (n + grain - 1) / grain;
+        for_each_index(num_chunks, [&](std::size_t c) {
+            std::size_t begin = c * grain;
+            f(begin, std::min(n, begin + grain));
+        });
+    }
+
+    /**
+     * @return number of chunks for_each_range will use for the given size.
+     */
+    inline std::size_t num_chunks(std::size_t n, std::size_t grain) {
+        grain = std::max<std::size_t>(grain, 1);
+        return (n + grain - 1) / grain;
+    }
+}
+
+#endif //SWAG_SCANNER_PARALLEL_H
@@ -0,0 +1,287 @@
+#include "RansacPlane.h"
+#include <Eigen/Eigenvalues>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace {
+    /**
+     * Distance of every point to the plane, blended with the normal angle like SACMODEL_NORMAL_PLANE.
+     */
+    void plane_distances(const algos::PlaneFitData &data, const Eigen::Vector4f &plane, float weight,
+                         Eigen::ArrayXf &out) {
+        out = (data.x * plane[0] + data.y * plane[1] + data.z * plane[2] + plane[3]).abs();
+        if (weight > 0) {
+            // acos(|cos|) is already min(angle, pi - angle)
+            Eigen::ArrayXf cos = (data.nx * plane[0] + data.ny * plane[1] + data.nz * plane[2]).abs().min(1.0f);
+            out = weight * cos.acos() + (1 - weight) * out;
+        }
+    }
+
+    /**
+     * RANSAC iterations needed to draw an all inlier sample with the given probability.
+     */
+    double needed_iterations(double inlier_ratio, double probability, int max_iterations) {
+        double all_inliers = std::pow(inlier_ratio, 3);
+        if (all_inliers >= 1) {
+            return 0;
+        }
+        if (all_inliers <= 0) {
+            return max_iterations;
+        }
+        return std::log(1 - probability) / std::log(1 - all_inliers);
+    }
+
+    /**
+     * Copy of the given entries of the data, so a masked fit scans only the entries it uses.
+     */
+    algos::PlaneFitData select(const algos::PlaneFitData &data, const std::vector<Eigen::Index> &positions,
+                               bool with_normals) {
+        const Eigen::Index n = Eigen::Index(positions.size());
+        algos::PlaneFitData out;
+        out.x.resize(n);
+        out.y.resize(n);
+        out.z.resize(n);
+        if (with_normals) {
+            out.nx.resize(n);
+            out.ny.resize(n);
+            out.nz.resize(n);
+        }
+        out.index.resize(positions.size());
+        for (Eigen::Index k = 0; k < n; k++) {
+            const Eigen::Index i = positions[k];
+            out.x[k] = data.x[i];
+            out.y[k] = data.y[i];
+            out.z[k] = data.z[i];
+            if (with_normals) {
+                out.nx[k] = data.nx[i];
+                out.ny[k] = data.ny[i];
+                out.nz[k] = data.nz[i];
+            }
+            out.index[k] = data.index[i];
+        }
+        return out;
+    }
+
+    /**
+     * RANSAC over every entry of the data, the inlier mask is over the same entries.
+     */
+    algos::PlaneFitResult fit_all(const algos::PlaneFitData &data, const algos::PlaneFitParams &params) {
+        const bool use_normals = params.normal_distance_weight > 0;
+        const float weight = float(params.normal_distance_weight);
+        const float threshold = float(params.distance_threshold);
+        const Eigen::Index n = data.size();
+
+        algos::PlaneFitResult result;
+        if (n < 3) {
+            return result;
+        }
+
+        std::mt19937 rng(params.seed);
+        std::uniform_int_distribution<Eigen::Index> pick(0, n - 1);
+
+        // fixed random subset for the preemptive test, small enough to copy
+        algos::PlaneFitData subset;
+        const Eigen::Index m = params.preemptive_subset;
+        const bool use_subset = m > 0 && n > 4 * m;
+        if (use_subset) {
+            std::vector<Eigen::Index> picked(static_cast<std::size_t>(m));
+            for (auto &i : picked) {
+                i = pick(rng);
+            }
+            subset = select(data, picked, use_normals);
+        }
+
+        Eigen::Vector3f axis = Eigen::Vector3f::Zero();
+        if (params.axis.norm() > 0) {
+            axis = params.axis.normalized();
+        }
+
+        Eigen::ArrayXf distances(n);
+        Eigen::ArrayXf subset_distances(use_subset ? m : 0);
+        auto count_inliers = [&](const Eigen::Vector4f &plane) {
+            plane_distances(data, plane, weight, distances);
+            return Eigen::Index((distances < threshold).count());
+        };
+        Eigen::Index best_count = 0;
+        double best_ratio = 0;
+        Eigen::Vector4f best_plane = Eigen::Vector4f::Zero();
+        double needed = params.max_iterations;
+
+        while (result.iterations < params.max_iterations && result.iterations < needed) {
+            result.iterations++;
+            Eigen::Index i0 = pick(rng), i1 = pick(rng), i2 = pick(rng);
+            if (i0 == i1 || i0 == i2 || i1 == i2) {
+                continue;
+            }
+            const Eigen::Vector3f p0 = data.point(i0);
+            Eigen::Vector3f normal = (data.point(i1) - p0).cross(data.point(i2) - p0);
+            float length = normal.norm();
+            if (length < 1e-12f) {
+                continue;
+            }
+            normal /= length;
+            if (!axis.isZero()) {
+                float cos = std::min(std::abs(normal.dot(axis)), 1.0f);
+                if (std::acos(cos) > params.eps_angle) {
+                    continue;
+                }
+                if (normal.dot(axis) < 0) {
+                    normal = -normal;
+                }
+            }
+            Eigen::Vector4f plane(normal[0], normal[1], normal[2], -normal.dot(p0));
+
+            if (use_subset && best_count > 0) {
+                // drop it if its subset ratio is more than 3 sigma under the best ratio
+                plane_distances(subset, plane, weight, subset_distances);
+                double ratio = double((subset_distances < threshold).count()) / m;
+                double sigma = std::sqrt(best_ratio * (1 - best_ratio) / m);
+                if (ratio + 3 * sigma + 1.0 / m < best_ratio) {
+                    continue;
+                }
+            }
+            result.full_scores++;
+            Eigen::Index count = count_inliers(plane);
+            if (count > best_count) {
+                best_count = count;
+                best_plane = plane;
+                best_ratio = double(count) / n;
+                needed = needed_iterations(best_ratio, params.probability, params.max_iterations);
+            }
+        }
+        if (best_count == 0) {
+            return result;
+        }
+
+        if (params.refine && best_count >= 3) {
+            // least squares plane through the inliers, smallest eigenvector of their covariance
+            plane_distances(data, best_plane, weight, distances);
+            algos::PlaneMask inliers = distances < threshold;
+            Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+            for (Eigen::Index k = 0; k < n; k++) {
+                if (inliers[k]) {
+                    mean += data.point(k).cast<double>();
+                }
+            }
+            mean /= double(best_count);
+            Eigen::Matrix3d cov = Eigen::Matrix3d::Zero();
+            for (Eigen::Index k = 0; k < n; k++) {
+                if (inliers[k]) {
+                    Eigen::Vector3d d = data.point(k).cast<double>() - mean;
+                    cov += d * d.transpose();
+                }
+            }
+            Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(cov);
+            Eigen::Vector3f normal = solver.eigenvectors().col(0).cast<float>();
+            if (normal.dot(best_plane.head<3>()) < 0) {
+                normal = -normal;
+            }
+            Eigen::Vector4f refined(normal[0], normal[1], normal[2], -normal.dot(mean.cast<float>()));
+            if (count_inliers(refined) >= 3) {
+                best_plane = refined;
+            }
+        }
+
+        plane_distances(data, best_plane, weight, distances);
+        result.found = true;
+        result.coefficients = best_plane;
+        result.inlier_mask = distances < threshold;
+        for (Eigen::Index k = 0; k < n; k++) {
+            if (result.inlier_mask[k]) {
+                result.inliers.push_back(data.index[k]);
+            }
+        }
+        return result;
+    }
+}
+
+algos::PlaneFitData algos::PlaneFitData::gather(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                                const pcl::PointCloud<pcl::Normal> *normals,
+                                                const std::vector<int> *indices) {
+    if (normals != nullptr && normals->points.size() != cloud.points.size()) {
+        throw std::invalid_argument("plane fit needs one normal per point");
+    }
+    const bool with_normals = normals != nullptr;
+    const std::size_t candidates = indices != nullptr ? indices->size() : cloud.points.size();
+    PlaneFitData data;
+    std::vector<float> x, y, z, nx, ny, nz;
+    data.index.reserve(candidates);
+    x.reserve(candidates);
+    y.reserve(candidates);
+    z.reserve(candidates);
+    for (std::size_t k = 0; k < candidates; k++) {
+        const int i = indices != nullptr ? (*indices)[k] : int(k);
+        const pcl::PointXYZ &p = cloud.points[i];
+        if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) {
+            continue;
+        }
+        if (with_normals) {
+            const pcl::Normal &n = normals->points[i];
+            if (!std::isfinite(n.normal_x) || !std::isfinite(n.normal_y) || !std::isfinite(n.normal_z)) {
+                continue;
+            }
+            nx.push_back(n.normal_x);
+            ny.push_back(n.normal_y);
+            nz.push_back(n.normal_z);
+        }
+        x.push_back(p.x);
+        y.push_back(p.y);
+        z.push_back(p.z);
+        data.index.push_back(i);
+    }
+    auto to_array = [](const std::vector<float> &v) {
+        return Eigen::ArrayXf(Eigen::Map<const Eigen::ArrayXf>(v.data(), Eigen::Index(v.size())));
+    };
+    data.x = to_array(x);
+    data.y = to_array(y);
+    data.z = to_array(z);
+    if (with_normals) {
+        data.nx = to_array(nx);
+        data.ny = to_array(ny);
+        data.nz = to_array(nz);
+    }
+    return data;
+}
+
+algos::PlaneFitResult algos::fit_plane_ransac(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                              const pcl::PointCloud<pcl::Normal> *normals,
+                                              const std::vector<int> *indices,
+                                              const PlaneFitParams &params) {
+    const bool use_normals = params.normal_distance_weight > 0;
+    if (use_normals && normals == nullptr) {
+        throw std::invalid_argument("fit_plane_ransac needs one normal per point for normal_distance_weight");
+    }
+    return fit_plane_ransac(PlaneFitData::gather(cloud, use_normals ? normals : nullptr, indices), nullptr, params);
+}
+
+algos::PlaneFitResult algos::fit_plane_ransac(const PlaneFitData &data,
+                                              const PlaneMask *mask,
+                                              const PlaneFitParams &params) {
+    const bool use_normals = params.normal_distance_weight > 0;
+    if (use_normals && !data.has_normals() && data.size() > 0) {
+        throw std::invalid_argument("fit_plane_ransac needs one normal per point for normal_distance_weight");
+    }
+    if (mask != nullptr && mask->size() != data.size()) {
+        throw std::invalid_argument("plane fit mask doesn't match the data");
+    }
+    if (mask == nullptr) {
+        return fit_all(data, params);
+    }
+
+    // copy the selected entries once, every hypothesis is then scored over them only
+    std::vector<Eigen::Index> positions;
+    positions.reserve(std::size_t(mask->count()));
+    for (Eigen::Index k = 0; k < data.size(); k++) {
+        if ((*mask)[k]) {
+            positions.push_back(k);
+        }
+    }
+    PlaneFitResult result = fit_all(select(data, positions, use_normals), params);
+    PlaneMask compact_mask = std::move(result.inlier_mask);
+    result.inlier_mask = PlaneMask::Constant(data.size(), false);
+    for (Eigen::Index k = 0; k < compact_mask.size(); k++) {
+        result.inlier_mask[positions[k]] = compact_mask[k];
+    }
+    return result;
+}
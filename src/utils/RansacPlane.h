@@ -0,0 +1,132 @@
+#ifndef SWAG_SCANNER_RANSACPLANE_H
+#define SWAG_SCANNER_RANSACPLANE_H
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <vector>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+namespace algos {
+
+    /**
+     * Settings for fit_plane_ransac, named after the pcl::SACSegmentationFromNormals setters they replace.
+     */
+    struct PlaneFitParams {
+        double distance_threshold = .005;
+
+        /**
+         * Hard cap. RANSAC normally stops much earlier, as soon as
+         * log(1 - probability) / log(1 - w^3) hypotheses have been tried for the best inlier ratio w so far.
+         */
+        int max_iterations = 10000;
+        double probability = .99;
+
+        /**
+         * Blend of normal angle (radians) and point distance, like SACMODEL_NORMAL_PLANE. Needs normals if > 0.
+         */
+        double normal_distance_weight = 0;
+
+        /**
+         * Only accept planes whose normal is within eps_angle (radians) of this axis, either direction, like
+         * SACMODEL_NORMAL_PARALLEL_PLANE. The returned normal points along the axis. Zero means no constraint.
+         */
+        Eigen::Vector3f axis = Eigen::Vector3f::Zero();
+        double eps_angle = 0;
+
+        /**
+         * Hypotheses are first scored on a random subset of this many points and dropped if they clearly
+         * can't beat the best one. 0 scores every hypothesis on every point.
+         */
+        int preemptive_subset = 512;
+
+        /**
+         * Least squares refit on the inliers, then select the inliers again, like setOptimizeCoefficients.
+         */
+        bool refine = true;
+
+        /**
+         * Same seed, same cloud, same plane.
+         */
+        uint32_t seed = 42;
+    };
+
+    /**
+     * Selects entries of a PlaneFitData, e.g. the points left after removing the ground.
+     */
+    using PlaneMask = Eigen::Array<bool, Eigen::Dynamic, 1>;
+
+    /**
+     * Usable points of a cloud (and their normals) in structure of arrays form, gathered once and shared by
+     * every fit on the same cloud. Entry k came from cloud point index[k].
+     */
+    struct PlaneFitData {
+        Eigen::ArrayXf x, y, z;
+        Eigen::ArrayXf nx, ny, nz; /** empty without normals */
+        std::vector<int> index;
+
+        /**
+         * Gather the finite points (with finite normals if normals are given).
+         *
+         * @param cloud cloud to read.
+         * @param normals normals of the cloud or nullptr.
+         * @param indices points of the cloud to use, nullptr for all of them.
+         * @throws invalid_argument if the normals don't match the cloud.
+         */
+        static PlaneFitData gather(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                   const pcl::PointCloud<pcl::Normal> *normals,
+                                   const std::vector<int> *indices);
+
+        Eigen::Index size() const {
+            return x.size();
+        }
+
+        bool has_normals() const {
+            return nx.size() == x.size() && x.size() > 0;
+        }
+
+        Eigen::Vector3f point(Eigen::Index k) const {
+            return {x[k], y[k], z[k]};
+        }
+    };
+
+    struct PlaneFitResult {
+        bool found = false;
+        Eigen::Vector4f coefficients = Eigen::Vector4f::Zero(); /** a, b, c, d with a unit normal */
+        std::vector<int> inliers;                               /** indices into the cloud */
+        PlaneMask inlier_mask;                                  /** inliers as a mask over the PlaneFitData */
+        int iterations = 0;
+        int full_scores = 0;                                    /** hypotheses that got past the subset test */
+    };
+
+    /**
+     * RANSAC plane fit with adaptive termination and preemptive scoring. Every hypothesis is scored with
+     * vectorized Eigen array expressions over a structure of arrays buffer. With a mask the selected entries
+     * are copied into a compact buffer once, so hypotheses never scan entries outside the mask.
+     *
+     * @param data gathered points and normals.
+     * @param mask entries to fit, nullptr for all of them.
+     * @param params settings.
+     * @return best plane and its inliers (within the mask).
+     * @throws invalid_argument if normals are needed but missing or the mask doesn't match the data.
+     */
+    PlaneFitResult fit_plane_ransac(const PlaneFitData &data, const PlaneMask *mask, const PlaneFitParams &params);
+
+    /**
+     * Convenience overload that gathers the points first.
+     *
+     * @param cloud cloud to fit, NaN points are skipped.
+     * @param normals normals of the cloud, required when normal_distance_weight > 0, nullptr otherwise.
+     * @param indices points of the cloud to use, nullptr for all of them.
+     * @param params settings.
+     * @return best plane and its inliers, found is false if there were fewer than three usable points or
+     * no hypothesis satisfied the axis constraint.
+     * @throws invalid_argument if normals are needed but missing or don't match the cloud.
+     */
+    PlaneFitResult fit_plane_ransac(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                    const pcl::PointCloud<pcl::Normal> *normals,
+                                    const std::vector<int> *indices,
+                                    const PlaneFitParams &params);
+}
+
+#endif //SWAG_SCANNER_RANSACPLANE_H
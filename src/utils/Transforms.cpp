@@ -0,0 +1,139 @@
+#include "Transforms.h"
+#include "Parallel.h"
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+Eigen::Matrix4f transforms::rotation_about_line(const Eigen::Vector3f &line_point,
+                                                const Eigen::Vector3f &line_direction,
+                                                float theta) {
+    const float c = std::cos(theta);
+    const float s = std::sin(theta);
+    const Eigen::Vector3f &d = line_direction;
+    // Rodrigues: R = cI + s[d]x + (1 - c)dd^T, then move the line through the origin and back
+    Eigen::Matrix3f cross;
+    cross << 0, -d[2], d[1],
+            d[2], 0, -d[0],
+            -d[1], d[0], 0;
+    Eigen::Matrix3f rotation = c * Eigen::Matrix3f::Identity() + s * cross + (1 - c) * d * d.transpose();
+
+    Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+    transform.topLeftCorner<3, 3>() = rotation;
+    transform.topRightCorner<3, 1>() = line_point - rotation * line_point;
+    return transform;
+}
+
+void transforms::transform_cloud(const pcl::PointCloud<pcl::PointXYZ> &in,
+                                 pcl::PointCloud<pcl::PointXYZ> &out,
+                                 const Eigen::Matrix4f &transform) {
+    if (&in != &out) {
+        out.header = in.header;
+        out.points.resize(in.points.size());
+        out.width = in.width;
+        out.height = in.height;
+        out.is_dense = in.is_dense;
+        out.sensor_origin_ = in.sensor_origin_;
+        out.sensor_orientation_ = in.sensor_orientation_;
+    }
+    const auto &src = in.points;
+    auto &dst = out.points;
+    parallel::for_each_range(src.size(), 1 << 15, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            transform_point(transform, src[i], dst[i]);
+        }
+    });
+}
+
+void transforms::transform_cloud(pcl::PointCloud<pcl::PointXYZ> &cloud, const Eigen::Matrix4f &transform) {
+    transform_cloud(cloud, cloud, transform);
+}
+
+std::size_t transforms::transform_cloud_cropped(const pcl::PointCloud<pcl::PointXYZ> &in,
+                                                pcl::PointCloud<pcl::PointXYZ> &out,
+                                                const Eigen::Matrix4f &transform,
+                                                const CylinderCrop &crop,
+                                                bool keep_organized) {
+    if (&in == &out && !keep_organized) {
+        // compacting in place would overwrite points other chunks still have to read
+        pcl::PointCloud<pcl::PointXYZ> compact;
+        std::size_t kept = transform_cloud_cropped(in, compact, transform, crop, false);
+        out = std::move(compact);
+        return kept;
+    }
+    const Eigen::RowVector3f height_row = transform.block<1, 3>(2, 0);
+    const float height_offset = transform(2, 3);
+    // |R p + t| = |p + R^T t| for a rotation R
+    const Eigen::Vector3f shift = transform.topLeftCorner<3, 3>().transpose() * transform.topRightCorner<3, 1>();
+    const float radius_sq = crop.radius * crop.radius;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    auto inside = [&](const pcl::PointXYZ &p) {
+        const Eigen::Vector3f v(p.x, p.y, p.z);
+        const float height = height_row.dot(v) + height_offset;
+        const float radial_sq = (v + shift).squaredNorm() - height * height;
+        // false for NaN points
+        return height >= crop.min_height && height <= crop.max_height && radial_sq <= radius_sq;
+    };
+
+    const std::size_t n = in.points.size();
+    const std::size_t grain = 1 << 15;
+    std::vector<std::size_t> chunk_kept(parallel::num_chunks(n, grain), 0);
+    if (keep_organized) {
+        if (&in != &out) {
+            out.header = in.header;
+            out.points.resize(n);
+            out.width = in.width;
+            out.height = in.height;
+            out.sensor_origin_ = in.sensor_origin_;
+            out.sensor_orientation_ = in.sensor_orientation_;
+        }
+        parallel::for_each_range(n, grain, [&](std::size_t begin, std::size_t end) {
+            std::size_t kept = 0;
+            for (std::size_t i = begin; i < end; i++) {
+                if (inside(in.points[i])) {
+                    transform_point(transform, in.points[i], out.points[i]);
+                    kept++;
+                } else {
+                    out.points[i].x = out.points[i].y = out.points[i].z = nan;
+                }
+            }
+            chunk_kept[begin / grain] = kept;
+        });
+        std::size_t kept = 0;
+        for (std::size_t k : chunk_kept) {
+            kept += k;
+        }
+        out.is_dense = kept == n;
+        return kept;
+    }
+
+    // count per chunk, then every chunk writes its survivors at its prefix offset
+    std::vector<uint8_t> keep(n);
+    parallel::for_each_range(n, grain, [&](std::size_t begin, std::size_t end) {
+        std::size_t kept = 0;
+        for (std::size_t i = begin; i < end; i++) {
+            keep[i] = inside(in.points[i]);
+            kept += keep[i];
+        }
+        chunk_kept[begin / grain] = kept;
+    });
+    std::vector<std::size_t> offsets(chunk_kept.size() + 1, 0);
+    for (std::size_t c = 0; c < chunk_kept.size(); c++) {
+        offsets[c + 1] = offsets[c] + chunk_kept[c];
+    }
+    out.header = in.header;
+    out.sensor_origin_ = in.sensor_origin_;
+    out.sensor_orientation_ = in.sensor_orientation_;
+    out.points.resize(offsets.back());
+    out.width = offsets.back();
+    out.height = 1;
+    out.is_dense = true;
+    parallel::for_each_range(n, grain, [&](std::size_t begin, std::size_t end) {
+        std::size_t o = offsets[begin / grain];
+        for (std::size_t i = begin; i < end; i++) {
+            if (keep[i]) {
+                transform_point(transform, in.points[i], out.points[o++]);
+            }
+        }
+    });
+    return offsets.back();
+}
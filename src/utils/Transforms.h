@@ -0,0 +1,82 @@
+#ifndef SWAG_SCANNER_TRANSFORMS_H
+#define SWAG_SCANNER_TRANSFORMS_H
+
+#include <Eigen/Core>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+/**
+ * Rigid transforms for whole clouds as one 4x4 matrix applied in a single pass, instead of per point
+ * trigonometry.
+ */
+namespace transforms {
+
+    /**
+     * Rotation about an arbitrary line, same result as algos::rotate_point_about_line.
+     *
+     * @param line_point point on the line.
+     * @param line_direction direction of the line (normalized).
+     * @param theta angle in radians.
+     * @return 4x4 homogeneous transform.
+     */
+    Eigen::Matrix4f rotation_about_line(const Eigen::Vector3f &line_point,
+                                        const Eigen::Vector3f &line_direction,
+                                        float theta);
+
+    /**
+     * Transform a single point. PCL points are 16 byte aligned with a padding float, so this is one 4x4 by 4
+     * SIMD product.
+     */
+    inline void transform_point(const Eigen::Matrix4f &transform, const pcl::PointXYZ &in, pcl::PointXYZ &out) {
+        out.getVector4fMap() = transform * Eigen::Vector4f(in.x, in.y, in.z, 1);
+    }
+
+    /**
+     * Transform every point of a cloud in parallel. NaN points stay NaN so organized clouds keep their grid.
+     * in and out may be the same cloud, otherwise out is resized and its memory reused.
+     *
+     * @param in cloud to transform.
+     * @param out transformed cloud.
+     * @param transform rigid transform.
+     */
+    void transform_cloud(const pcl::PointCloud<pcl::PointXYZ> &in,
+                         pcl::PointCloud<pcl::PointXYZ> &out,
+                         const Eigen::Matrix4f &transform);
+
+    /**
+     * Transform a cloud in place.
+     */
+    void transform_cloud(pcl::PointCloud<pcl::PointXYZ> &cloud, const Eigen::Matrix4f &transform);
+
+    /**
+     * Vertical cylinder around the turntable axis in world coordinates (the z axis through the origin).
+     * A point is inside if min_height <= z <= max_height and its distance from the axis is at most radius.
+     */
+    struct CylinderCrop {
+        float radius;
+        float min_height; /** a little above 0 also drops the turntable surface itself */
+        float max_height;
+    };
+
+    /**
+     * Transform a cloud and crop it to a cylinder of the target frame in one pass. The cylinder test is done
+     * on the source point (the height is one row of the transform, the axis distance comes from the norm,
+     * which the rotation keeps), so only points that survive get transformed.
+     * in and out may be the same cloud.
+     *
+     * @param in cloud to transform.
+     * @param out survivors in the target frame.
+     * @param transform rigid transform.
+     * @param crop cylinder in the target frame.
+     * @param keep_organized true puts NaN where points were rejected and keeps the grid, false writes only the
+     * survivors, in their original order.
+     * @return number of survivors.
+     */
+    std::size_t transform_cloud_cropped(const pcl::PointCloud<pcl::PointXYZ> &in,
+                                        pcl::PointCloud<pcl::PointXYZ> &out,
+                                        const Eigen::Matrix4f &transform,
+                                        const CylinderCrop &crop,
+                                        bool keep_organized = true);
+}
+
+#endif //SWAG_SCANNER_TRANSFORMS_H
@@ -0,0 +1,256 @@
+#ifndef SWAG_SCANNER_VOXELHASHMAP_H
+#define SWAG_SCANNER_VOXELHASHMAP_H
+
+#include "Parallel.h"
+#include <cstdint>
+#include <vector>
+#include <utility>
+
+namespace algos {
+
+    /**
+     * Number of bits each voxel axis gets inside a packed key. Three axes fit in 63 bits.
+     */
+    inline constexpr int VOXEL_KEY_BITS = 21;
+    inline constexpr uint32_t VOXEL_KEY_MAX = (1u << VOXEL_KEY_BITS) - 1;
+
+    /**
+     * Pack three non-negative voxel coordinates into one key. Coordinates must be <= VOXEL_KEY_MAX.
+     */
+    inline uint64_t pack_voxel_key(uint32_t x, uint32_t y, uint32_t z) {
+        return (uint64_t(x) << (2 * VOXEL_KEY_BITS)) | (uint64_t(y) << VOXEL_KEY_BITS) | uint64_t(z);
+    }
+
+    /**
+     * Inverse of pack_voxel_key.
+     */
+    inline void unpack_voxel_key(uint64_t key, uint32_t &x, uint32_t &y, uint32_t &z) {
+        x = uint32_t(key >> (2 * VOXEL_KEY_BITS)) & VOXEL_KEY_MAX;
+        y = uint32_t(key >> VOXEL_KEY_BITS) & VOXEL_KEY_MAX;
+        z = uint32_t(key) & VOXEL_KEY_MAX;
+    }
+
+    /**
+     * Scramble a packed key so neighboring voxels land far apart in the table (splitmix64 finalizer).
+     */
+    inline uint64_t hash_voxel_key(uint64_t key) {
+        key ^= key >> 30;
+        key *= 0xbf58476d1ce4e5b9ull;
+        key ^= key >> 27;
+        key *= 0x94d049bb133111ebull;
+        key ^= key >> 31;
+        return key;
+    }
+
+    /**
+     * Open addressing hash map from packed voxel keys to T, linear probing, power of two capacity.
+     * Memory only grows with the number of occupied voxels, never with the bounding box.
+     * Not thread safe, use one map per thread or shard.
+     */
+    template<typename T>
+    class VoxelHashMap {
+    public:
+        static constexpr uint64_t EMPTY_KEY = ~0ull;
+
+        /**
+         * @param expected number of voxels you expect to insert, avoids rehashing.
+         */
+        explicit VoxelHashMap(std::size_t expected = 0) {
+            std::size_t cap = 16;
+            while (cap < expected * 2) {
+                cap <<= 1;
+            }
+            keys.assign(cap, EMPTY_KEY);
+            values.resize(cap);
+            mask = cap - 1;
+        }
+
+        /**
+         * Get the value for the key, default constructing it if the key is new.
+         *
+         * @param key packed voxel key.
+         * @param inserted set to true if the key was not in the map yet.
+         * @return reference to the value, valid until the next insertion.
+         */
+        T &find_or_insert(uint64_t key, bool &inserted) {
+            if ((count + 1) * 2 > keys.size()) {
+                grow();
+            }
+            std::size_t slot = hash_voxel_key(key) & mask;
+            while (keys[slot] != EMPTY_KEY) {
+                if (keys[slot] == key) {
+                    inserted = false;
+                    return values[slot];
+                }
+                slot = (slot + 1) & mask;
+            }
+            keys[slot] = key;
+            values[slot] = T();
+            count++;
+            inserted = true;
+            return values[slot];
+        }
+
+        /**
+         * Make room for this many voxels in total without rehashing.
+         */
+        void reserve(std::size_t expected) {
+            while (keys.size() < expected * 2) {
+                grow();
+            }
+        }
+
+        T &operator[](uint64_t key) {
+            bool inserted;
+            return find_or_insert(key, inserted);
+        }
+
+        /**
+         * @return pointer to the value or nullptr if the key is not in the map.
+         */
+        const T *find(uint64_t key) const {
+            std::size_t slot = hash_voxel_key(key) & mask;
+            while (keys[slot] != EMPTY_KEY) {
+                if (keys[slot] == key) {
+                    return &values[slot];
+                }
+                slot = (slot + 1) & mask;
+            }
+            return nullptr;
+        }
+
+        T *find(uint64_t key) {
+            return const_cast<T *>(static_cast<const VoxelHashMap *>(this)->find(key));
+        }
+
+        std::size_t size() const {
+            return count;
+        }
+
+        /**
+         * Raw slot access so callers can walk the table in parallel. Empty slots hold EMPTY_KEY.
+         */
+        std::size_t capacity() const {
+            return keys.size();
+        }
+
+        uint64_t slot_key(std::size_t slot) const {
+            return keys[slot];
+        }
+
+        T &slot_value(std::size_t slot) {
+            return values[slot];
+        }
+
+        const T &slot_value(std::size_t slot) const {
+            return values[slot];
+        }
+
+        /**
+         * Call f(key, value) on every occupied slot.
+         */
+        template<typename F>
+        void for_each(F &&f) {
+            for (std::size_t i = 0; i < keys.size(); i++) {
+                if (keys[i] != EMPTY_KEY) {
+                    f(keys[i], values[i]);
+                }
+            }
+        }
+
+    private:
+        std::vector<uint64_t> keys;
+        std::vector<T> values;
+        std::size_t count = 0;
+        std::size_t mask = 0;
+
+        void grow() {
+            std::vector<uint64_t> old_keys = std::move(keys);
+            std::vector<T> old_values = std::move(values);
+            keys.assign(old_keys.size() * 2, EMPTY_KEY);
+            values = std::vector<T>(old_keys.size() * 2);
+            mask = keys.size() - 1;
+            for (std::size_t i = 0; i < old_keys.size(); i++) {
+                if (old_keys[i] == EMPTY_KEY) {
+                    continue;
+                }
+                std::size_t slot = hash_voxel_key(old_keys[i]) & mask;
+                while (keys[slot] != EMPTY_KEY) {
+                    slot = (slot + 1) & mask;
+                }
+                keys[slot] = old_keys[i];
+                values[slot] = std::move(old_values[i]);
+            }
+        }
+    };
+
+    /**
+     * Shard a key belongs to when voxels are split over num_shards maps.
+     */
+    inline std::size_t voxel_shard(uint64_t key, std::size_t num_shards) {
+        return (hash_voxel_key(key) >> 32) % num_shards;
+    }
+
+    /**
+     * Accumulate per-point data into existing sharded maps on every core without locks.
+     * Every shard sees its points in increasing index order, so the result does not depend on thread timing.
+     * Keys must always go to voxel_shard(key, shards.size()), so keep the number of shards fixed for the
+     * lifetime of the maps.
+     *
+     * @param keys packed key per point, EMPTY_KEY for points that should be skipped.
+     * @param shards maps to accumulate into, one per shard.
+     * @param add called as add(T &acc, size_t point_index, bool inserted) for every point.
+     */
+    template<typename T, typename F>
+    void shard_accumulate_voxels(const std::vector<uint64_t> &keys, std::vector<VoxelHashMap<T>> &shards, F &&add) {
+        const std::size_t n = keys.size();
+        const std::size_t grain = 1 << 16;
+        const std::size_t num_shards = shards.size();
+        const std::size_t chunks = parallel::num_chunks(n, grain);
+
+        // bucket point indices by shard, chunk by chunk, so every shard can walk its points in order
+        std::vector<std::vector<std::vector<uint32_t>>> buckets(chunks,
+                                                                std::vector<std::vector<uint32_t>>(num_shards));
+        parallel::for_each_range(n, grain, [&](std::size_t begin, std::size_t end) {
+            auto &chunk_buckets = buckets[begin / grain];
+            for (std::size_t i = begin; i < end; i++) {
+                if (keys[i] != VoxelHashMap<T>::EMPTY_KEY) {
+                    chunk_buckets[voxel_shard(keys[i], num_shards)].push_back(uint32_t(i));
+                }
+            }
+        });
+
+        parallel::for_each_index(num_shards, [&](std::size_t s) {
+            std::size_t expected = 0;
+            for (std::size_t c = 0; c < chunks; c++) {
+                expected += buckets[c][s].size();
+            }
+            shards[s].reserve(shards[s].size() + expected / 4);
+            for (std::size_t c = 0; c < chunks; c++) {
+                for (uint32_t i : buckets[c][s]) {
+                    bool inserted;
+                    T &acc = shards[s].find_or_insert(keys[i], inserted);
+                    add(acc, std::size_t(i), inserted);
+                }
+            }
+        });
+    }
+
+    /**
+     * Accumulate per-point data into voxels on every core without locks.
+     * Keys are split into shards by hash, and every shard owns a private map that sees its points in
+     * increasing index order. The result does not depend on thread timing.
+     *
+     * @param keys packed key per point, EMPTY_KEY for points that should be skipped.
+     * @param add called as add(T &acc, size_t point_index, bool inserted) for every point.
+     * @return one map per shard, together they hold every voxel exactly once.
+     */
+    template<typename T, typename F>
+    std::vector<VoxelHashMap<T>> shard_accumulate_voxels(const std::vector<uint64_t> &keys, F &&add) {
+        std::vector<VoxelHashMap<T>> shards(parallel::default_pool().size() + 1);
+        shard_accumulate_voxels(keys, shards, std::forward<F>(add));
+        return shards;
+    }
+}
+
+#endif //SWAG_SCANNER_VOXELHASHMAP_H
@@ -8,6 +8,8 @@
 #include "Plane.h"
 #include "Normal.h"
 #include "Point.h"
+#include "CenterPointSolver.h"
+#include <Eigen/Geometry>
 
 
 class CalibrationPhysicalFixture : public ::testing::Test {
@@ -73,3 +75,105 @@ TEST_F(CalibrationPhysicalFixture, TestBuildbMatrix) {
     ASSERT_NEAR(b(5, 0), -0.0117, .001);
     ASSERT_NEAR(b(8, 0), 0.0153, .001);
 }
+
+/**
+ * Upright planes of a fixture rotating about a known axis, one of them knocked off. IRLS over all pairs should
+ * still land on the axis and flag the bad view, disabling it should give the exact answer.
+ */
+TEST(CenterPointSolverTests, TestRobustToBadView) {
+    Eigen::Vector3d axis = Eigen::Vector3d(0, -.87, -.5).normalized();
+    Eigen::Vector3d center(.01, .03, .43);
+    Eigen::Vector3d n0 = axis.cross(Eigen::Vector3d::UnitX()).normalized();
+    model::CenterPointSolver solver;
+    solver.set_axis(equations::Normal(axis[0], axis[1], axis[2]));
+    for (int i = 0; i < 12; i++) {
+        Eigen::Vector3d n = Eigen::AngleAxisd(i * M_PI / 12, axis) * n0;
+        // plane 4 cm from the axis, view 5 shifted by 1 cm
+        double distance = i == 5 ? .05 : .04;
+        solver.add_view(equations::Plane(n[0], n[1], n[2], distance - n.dot(center)));
+    }
+
+    auto off_axis = [&](const Eigen::Vector3d &x) {
+        Eigen::Vector3d d = x - center;
+        return (d - d.dot(axis) * axis).norm();
+    };
+    model::CenterPointSolution robust = solver.solve();
+    ASSERT_EQ(robust.pairs, 66);
+    ASSERT_LT(off_axis(robust.center), 5e-4);
+    for (int i = 0; i < 12; i++) {
+        if (i != 5) {
+            ASSERT_GT(robust.view_weights[i], robust.view_weights[5]);
+        }
+    }
+
+    solver.set_view_enabled(5, false);
+    model::CenterPointSolution clean = solver.solve();
+    ASSERT_EQ(clean.pairs, 55);
+    ASSERT_LT(off_axis(clean.center), 1e-9);
+    ASSERT_EQ(clean.view_weights[5], 0);
+}
+
+/**
+ * Organized view of the turntable from a pinhole camera at the origin looking down +z: an upright board on
+ * the rotation axis, turned by angle, in front of the ground plane.
+ */
+std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> render_calibration_view(const Eigen::Vector3d &axis,
+                                                                        const Eigen::Vector3d &center,
+                                                                        double angle) {
+    const int width = 160, height = 120;
+    const double focal = 200;
+    Eigen::Vector3d board = Eigen::AngleAxisd(angle, axis) * axis.cross(Eigen::Vector3d::UnitX()).normalized();
+    auto cloud = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    cloud->width = width;
+    cloud->height = height;
+    for (int v = 0; v < height; v++) {
+        for (int u = 0; u < width; u++) {
+            Eigen::Vector3d ray((u - width / 2) / focal, (v - height / 2) / focal, 1);
+            Eigen::Vector3d p = Eigen::Vector3d::Constant(std::nan(""));
+            // board through the axis, 10 cm either side of it and 15 cm tall
+            double t = board.dot(center) / board.dot(ray);
+            Eigen::Vector3d d = t * ray - center;
+            double h = d.dot(axis);
+            if (t > 0 && h > 0 && h < .15 && (d - h * axis).norm() < .1) {
+                p = t * ray;
+            } else if (axis.dot(ray) < 0) {
+                p = axis.dot(center) / axis.dot(ray) * ray;
+            }
+            cloud->points.push_back(pcl::PointXYZ(float(p[0]), float(p[1]), float(p[2])));
+        }
+    }
+    cloud->is_dense = false;
+    return cloud;
+}
+
+/**
+ * Fitting the views in the background while they are captured should give exactly what fitting them all at
+ * the end gives, however the pool schedules them, and land on the axis of rotation.
+ */
+TEST(CalibrationModelTests, TestIncrementalMatchesBatch) {
+    Eigen::Vector3d axis = Eigen::Vector3d(0, -.87, -.5).normalized();
+    Eigen::Vector3d center(.005, .03, .45);
+    model::CalibrationModel mod;
+    mod.start_incremental_calibration();
+    for (int i = 0; i < 6; i++) {
+        auto cloud = render_calibration_view(axis, center, (i - 2.5) * M_PI / 12);
+        std::string name = "view_" + std::to_string(i);
+        mod.add_cloud(cloud, name);
+        mod.fit_view_async(name);
+    }
+    pcl::PointXYZ incremental = mod.finish_incremental_calibration();
+    std::vector<equations::Plane> incremental_uprights = mod.upright_planes;
+
+    pcl::PointXYZ batch = mod.calculate_center_point();
+    ASSERT_EQ(mod.upright_planes.size(), 6);
+    for (std::size_t i = 0; i < 6; i++) {
+        ASSERT_EQ(incremental_uprights[i].A, mod.upright_planes[i].A);
+        ASSERT_EQ(incremental_uprights[i].D, mod.upright_planes[i].D);
+    }
+    ASSERT_EQ(incremental.x, batch.x);
+    ASSERT_EQ(incremental.y, batch.y);
+    ASSERT_EQ(incremental.z, batch.z);
+
+    Eigen::Vector3d d = Eigen::Vector3d(batch.x, batch.y, batch.z) - center;
+    ASSERT_LT((d - d.dot(axis) * axis).norm(), 1e-3);
+}
@@ -0,0 +1,46 @@
+#include "gtest/gtest.h"
+#include "TSDFVolume.h"
+#include <pcl/point_types.h>
+
+class FusionFixture : public ::testing::Test {
+
+protected:
+    pcl::PointCloud<pcl::PointXYZ> wall;
+
+    virtual void SetUp() {
+        // flat wall 30 cm in front of a camera at the origin
+        for (int i = 0; i < 200; i++) {
+            for (int j = 0; j < 200; j++) {
+                wall.push_back(pcl::PointXYZ(-.05f + .0005f * i, -.05f + .0005f * j, .3f));
+            }
+        }
+    }
+};
+
+/**
+ * The zero crossing of a fused wall should sit on the wall, and integrating the same view again should
+ * only change weights, not allocate voxels.
+ */
+TEST_F(FusionFixture, TestTSDFWallSurface) {
+    const float voxel_size = .002;
+    fusion::TSDFVolume volume(voxel_size, 3 * voxel_size);
+    volume.integrate(wall, Eigen::Matrix4f::Identity(), Eigen::Vector3f::Zero());
+    std::size_t voxels = volume.size();
+    volume.integrate(wall, Eigen::Matrix4f::Identity(), Eigen::Vector3f::Zero());
+    EXPECT_EQ(volume.size(), voxels);
+
+    const fusion::TSDFVoxel *in_front = volume.find(Eigen::Vector3f(0, 0, .3f - 2 * voxel_size));
+    const fusion::TSDFVoxel *behind = volume.find(Eigen::Vector3f(0, 0, .3f + 2 * voxel_size));
+    ASSERT_NE(in_front, nullptr);
+    ASSERT_NE(behind, nullptr);
+    EXPECT_GT(in_front->tsdf, 0);
+    EXPECT_LT(behind->tsdf, 0);
+    EXPECT_EQ(in_front->weight, 2);
+
+    pcl::PointCloud<pcl::PointXYZ> surface = volume.extract_surface(2);
+    ASSERT_GT(surface.size(), 0);
+    EXPECT_LT(surface.size(), wall.size());
+    for (const auto &p : surface.points) {
+        EXPECT_NEAR(p.z, .3f, voxel_size);
+    }
+}
@@ -0,0 +1,226 @@
+#include "gtest/gtest.h"
+#include "ICPEngine.h"
+#include "PoseGraph.h"
+#include "OnlineRegistration.h"
+#include "Algorithms.h"
+#include <pcl/point_types.h>
+#include <pcl/common/transforms.h>
+#include <random>
+
+class RegistrationFixture : public ::testing::Test {
+
+protected:
+    std::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> target;
+
+    virtual void SetUp() {
+        // wavy surface so ICP has something to lock onto in every direction
+        target = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> dist(-.05, .05);
+        for (int i = 0; i < 3000; i++) {
+            float x = dist(rng);
+            float y = dist(rng);
+            target->push_back(pcl::PointXYZ(x, y, .02f * std::sin(60 * x) + .03f * std::cos(40 * y)));
+        }
+    }
+};
+
+/**
+ * Move a copy of the target by a known transform and make sure ICP undoes it.
+ */
+TEST_F(RegistrationFixture, TestICPEngineRecoversTransform) {
+    Eigen::Affine3f moved = Eigen::Affine3f::Identity();
+    moved.rotate(Eigen::AngleAxisf(.05, Eigen::Vector3f::UnitZ()));
+    moved.translation() << .003, -.002, .001;
+    auto source = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    pcl::transformPointCloud(*target, *source, moved.matrix());
+
+    registration::ICPParams params;
+    params.euclidean_fitness_epsilon = 1e-12;
+    registration::ICPEngine engine(params);
+    engine.set_views({source, target});
+    registration::ICPResult result = engine.align_views(0, 1);
+
+    Eigen::Matrix4f should_be_identity = result.transform * moved.matrix();
+    EXPECT_TRUE(result.stats.converged);
+    EXPECT_EQ(result.stats.iteration_ms.size(), result.stats.iterations);
+    EXPECT_LT((should_be_identity - Eigen::Matrix4f::Identity()).norm(), 1e-4);
+    EXPECT_LT(result.stats.fitness, 1e-10);
+    EXPECT_EQ(engine.find_index(target), &engine.get_index(1));
+}
+
+/**
+ * Views every 45 degrees with a drifting start, exact neighbor edges and a loop closure edge.
+ * The optimized poses should land back on the true ones.
+ */
+TEST_F(RegistrationFixture, TestPoseGraphLoopClosure) {
+    const int num_views = 8;
+    const float angle = 45;
+    std::vector<Eigen::Matrix4d> truth;
+    std::vector<Eigen::Matrix4d> initial;
+    for (int i = 0; i < num_views; i++) {
+        Eigen::Matrix4d pose = algos::z_rotation_matrix(angle * i).cast<double>();
+        pose(0, 3) = .001 * i;
+        truth.push_back(pose);
+        // backlash style drift that grows around the circle
+        initial.push_back(algos::z_rotation_matrix(angle * i + .5f * i).cast<double>());
+    }
+
+    registration::PoseGraph graph(initial);
+    for (int i = 0; i < num_views; i++) {
+        int j = (i + 1) % num_views;
+        graph.add_edge(i, j, truth[j].inverse() * truth[i]);
+    }
+    EXPECT_GT(graph.total_error(), 1e-6);
+    graph.optimize();
+    EXPECT_LT(graph.total_error(), 1e-12);
+    for (int i = 0; i < num_views; i++) {
+        EXPECT_LT((graph.get_poses()[i] - truth[i]).norm(), 1e-6);
+    }
+}
+
+/**
+ * Coarse to fine should land on the same transform as plain ICP.
+ */
+TEST_F(RegistrationFixture, TestICPPyramidRecoversTransform) {
+    Eigen::Affine3f moved = Eigen::Affine3f::Identity();
+    moved.rotate(Eigen::AngleAxisf(.08, Eigen::Vector3f::UnitZ()));
+    moved.translation() << .004, -.003, .002;
+    auto source = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    pcl::transformPointCloud(*target, *source, moved.matrix());
+
+    registration::ICPParams params;
+    params.euclidean_fitness_epsilon = 1e-12;
+    params.pyramid_leaf_sizes = {.004, .002, .001};
+    registration::ICPEngine engine(params);
+    engine.set_views({source, target});
+    registration::ICPResult result = engine.align_views(0, 1);
+
+    Eigen::Matrix4f should_be_identity = result.transform * moved.matrix();
+    EXPECT_TRUE(result.stats.converged);
+    EXPECT_EQ(result.stats.level_iterations.size(), 4);
+    EXPECT_LE(result.stats.level_iterations.back(), params.full_resolution_iterations);
+    EXPECT_LT((should_be_identity - Eigen::Matrix4f::Identity()).norm(), 1e-4);
+}
+
+/**
+ * A pyramid whose full resolution level runs out of iterations is not converged, whatever the proxies did.
+ */
+TEST_F(RegistrationFixture, TestICPPyramidOutOfIterations) {
+    Eigen::Affine3f moved = Eigen::Affine3f::Identity();
+    moved.translation() << .004, -.003, .002;
+    auto source = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    pcl::transformPointCloud(*target, *source, moved.matrix());
+
+    registration::ICPParams params;
+    params.transformation_epsilon = 0;
+    params.euclidean_fitness_epsilon = -1;
+    params.max_iterations = 3;
+    params.full_resolution_iterations = 1;
+    params.pyramid_leaf_sizes = {.004, .002};
+    registration::ICPEngine engine(params);
+    engine.set_views({source, target});
+    registration::ICPResult result = engine.align_views(0, 1);
+
+    EXPECT_FALSE(result.stats.converged);
+    EXPECT_EQ(result.stats.stop_reason, "max_iterations");
+    EXPECT_EQ(result.stats.level_iterations.back(), 1);
+}
+
+/**
+ * Point to plane with normals from the organized grid should converge in fewer iterations than point to point.
+ */
+TEST_F(RegistrationFixture, TestPointToPlaneConvergesFaster) {
+    auto grid = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    grid->width = 100;
+    grid->height = 100;
+    for (int v = 0; v < 100; v++) {
+        for (int u = 0; u < 100; u++) {
+            float x = -.05f + .001f * u;
+            float y = -.05f + .001f * v;
+            grid->points.push_back(pcl::PointXYZ(x, y, .02f * std::sin(60 * x) + .03f * std::cos(40 * y)));
+        }
+    }
+    auto normals = std::make_shared<pcl::PointCloud<pcl::Normal>>(algos::estimate_organized_normals(*grid, 1));
+    Eigen::Affine3f moved = Eigen::Affine3f::Identity();
+    moved.rotate(Eigen::AngleAxisf(.03, Eigen::Vector3f::UnitZ()));
+    moved.translation() << .002, -.001, .001;
+    auto source = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    pcl::transformPointCloud(*grid, *source, moved.matrix());
+
+    registration::ICPParams params;
+    params.euclidean_fitness_epsilon = 1e-12;
+    registration::ICPEngine point_engine(params);
+    point_engine.set_views({source, grid});
+    registration::ICPResult point = point_engine.align_views(0, 1);
+
+    params.method = registration::ICPMethod::POINT_TO_PLANE;
+    registration::ICPEngine plane_engine(params);
+    plane_engine.set_views({source, grid}, {nullptr, normals});
+    registration::ICPResult plane = plane_engine.align_views(0, 1);
+
+    Eigen::Matrix4f should_be_identity = plane.transform * moved.matrix();
+    EXPECT_TRUE(plane.stats.converged);
+    EXPECT_LT((should_be_identity - Eigen::Matrix4f::Identity()).norm(), 1e-4);
+    EXPECT_LT(plane.stats.iterations, point.stats.iterations);
+}
+
+/**
+ * Views coming off the turntable one at a time. The second view is where the turntable said, the third
+ * slipped and should be flagged and placed at the turntable angle instead.
+ */
+TEST_F(RegistrationFixture, TestOnlineRegistrationFlagsSlippedView) {
+    const float angle = 10;
+    std::vector<float> actual = {0, angle, 2 * angle + 8};
+    registration::ICPParams params;
+    params.euclidean_fitness_epsilon = 1e-12;
+    registration::OnlineRegistration online(params, angle);
+    for (float a : actual) {
+        auto view = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+        pcl::transformPointCloud(*target, *view, algos::z_rotation_matrix(a).inverse());
+        online.add_view(view);
+    }
+
+    const auto &qualities = online.get_qualities();
+    const auto &poses = online.get_poses();
+    ASSERT_EQ(poses.size(), 3);
+    EXPECT_TRUE(qualities[1].good);
+    EXPECT_LT(qualities[1].deviation_deg, .1);
+    EXPECT_LT((poses[1] - algos::z_rotation_matrix(angle)).norm(), 1e-3);
+    EXPECT_FALSE(qualities[2].good);
+    EXPECT_FALSE(qualities[2].reason.empty());
+    EXPECT_LT((poses[2] - algos::z_rotation_matrix(2 * angle)).norm(), 1e-3);
+}
+
+/**
+ * Neighboring views only share part of the object. Points of the new view the previous one never saw must
+ * not fail it, only the overlap is scored.
+ */
+TEST_F(RegistrationFixture, TestOnlineRegistrationPartialOverlap) {
+    auto first = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    auto second = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    for (const auto &p : target->points) {
+        if (p.x < .02) {
+            first->push_back(p);
+        }
+        if (p.x > -.02) {
+            second->push_back(p);
+        }
+    }
+    registration::ICPParams params;
+    params.euclidean_fitness_epsilon = 1e-12;
+    params.max_correspondence_distance = .005;
+    registration::OnlineRegistration online(params, 0);
+    online.add_view(first);
+    registration::ViewQuality quality = online.add_view(second);
+
+    // the far side of the second view is centimeters away from the first, fitness over every point says so
+    EXPECT_GT(quality.icp.fitness, 1e-5);
+    EXPECT_TRUE(quality.good) << quality.reason;
+    EXPECT_GT(quality.icp.overlap, .5);
+    EXPECT_LT(quality.icp.overlap, .8);
+    EXPECT_LT(quality.icp.inlier_rmse, .003);
+    // and the ICP result is used, close to where the views really are
+    EXPECT_LT(quality.deviation_deg, 1);
+    EXPECT_LT(quality.deviation_m, .001);
+}
@@ -1,5 +1,6 @@
 #include "gtest/gtest.h"
 #include "Algorithms.h"
+#include "Plane.h"
 #include "Visualizer.h"
 #include "CameraTypes.h"
 #include <pcl/point_types.h>
@@ -122,3 +123,185 @@ TEST_F(AlgosFixture, TestTransformCoordinate) {
 }
 
 
+
+/**
+ * Sparse voxel grid should keep one point per occupied voxel and average the points inside it.
+ */
+TEST_F(AlgosFixture, TestVoxelHashDownsampleCentroid) {
+    auto cloud = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    cloud->push_back(pcl::PointXYZ(.0001, .0001, .0001));
+    cloud->push_back(pcl::PointXYZ(.0003, .0003, .0003));
+    cloud->push_back(pcl::PointXYZ(.0051, .0001, .0001));
+    cloud->push_back(pcl::PointXYZ(std::nanf(""), 0, 0));
+    cloud->header.frame_id = "camera";
+    cloud->sensor_origin_ = Eigen::Vector4f(0, 0, .3, 0);
+
+    pcl::PointCloud<pcl::PointXYZ> downsampled = algos::voxel_hash_downsample(cloud, .001);
+
+    ASSERT_EQ(downsampled.size(), 2);
+    ASSERT_EQ(downsampled.header.frame_id, "camera");
+    ASSERT_FLOAT_EQ(downsampled.sensor_origin_[2], .3);
+    ASSERT_NEAR(downsampled.points[0].x, .0002, 1e-6);
+    ASSERT_NEAR(downsampled.points[1].x, .0051, 1e-6);
+}
+
+/**
+ * Tiny leaves over a huge extent would overflow a dense voxel index, the hashed grid should not care.
+ */
+TEST_F(AlgosFixture, TestVoxelHashDownsampleLargeExtent) {
+    auto cloud = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    cloud->push_back(pcl::PointXYZ(-100, -100, -100));
+    cloud->push_back(pcl::PointXYZ(100, 100, 100));
+    cloud->push_back(pcl::PointXYZ(100.00001, 100.00001, 100.00001));
+
+    pcl::PointCloud<pcl::PointXYZ> downsampled = algos::voxel_hash_downsample(cloud, .001,
+                                                                              algos::VoxelPolicy::FIRST_POINT);
+
+    ASSERT_EQ(downsampled.size(), 2);
+    ASSERT_FLOAT_EQ(downsampled.points[0].x, -100);
+    ASSERT_FLOAT_EQ(downsampled.points[1].x, 100);
+}
+
+/**
+ * Merged cloud should hold every finite point, transformed, in view order.
+ */
+TEST_F(AlgosFixture, TestMergeTransformedClouds) {
+    auto first = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    first->push_back(pcl::PointXYZ(1, 0, 0));
+    first->push_back(pcl::PointXYZ(std::nanf(""), 0, 0));
+    auto second = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    second->push_back(pcl::PointXYZ(1, 0, 0));
+    second->push_back(pcl::PointXYZ(0, 1, 0));
+
+    Eigen::Matrix4f shift = Eigen::Matrix4f::Identity();
+    shift(2, 3) = 1;
+    pcl::PointCloud<pcl::PointXYZ> merged = algos::merge_transformed_clouds(
+            {first, second}, {Eigen::Matrix4f::Identity(), algos::z_rotation_matrix(90) * shift});
+
+    ASSERT_EQ(merged.size(), 3);
+    ASSERT_FLOAT_EQ(merged.points[0].x, 1);
+    // rotating by -90 degrees about z takes x to -y
+    ASSERT_NEAR(merged.points[1].y, -1, 1e-6);
+    ASSERT_NEAR(merged.points[1].z, 1, 1e-6);
+    ASSERT_NEAR(merged.points[2].x, 1, 1e-6);
+}
+
+/**
+ * Voxel merge should average points of a voxel seen by two views and drop a voxel only one view saw, even when
+ * that view put several points in it.
+ */
+TEST_F(AlgosFixture, TestMergeViewsVoxelHash) {
+    auto first = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    first->push_back(pcl::PointXYZ(.0102, .0102, .0102));
+    first->push_back(pcl::PointXYZ(.0503, .0503, .0503));
+    first->push_back(pcl::PointXYZ(.0505, .0505, .0505));
+    auto second = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    second->push_back(pcl::PointXYZ(std::nanf(""), 0, 0));
+    second->push_back(pcl::PointXYZ(.0106, .0106, .0106));
+    std::vector<Eigen::Matrix4f> poses(2, Eigen::Matrix4f::Identity());
+
+    pcl::PointCloud<pcl::PointXYZ> merged = algos::merge_views_voxel_hash({first, second}, poses, .001, 2);
+    ASSERT_EQ(merged.size(), 1);
+    ASSERT_NEAR(merged.points[0].x, .0104, 1e-6);
+
+    merged = algos::merge_views_voxel_hash({first, second}, poses, .001, 1);
+    ASSERT_EQ(merged.size(), 2);
+    ASSERT_NEAR(merged.points[1].y, .0504, 1e-6);
+    ASSERT_THROW(algos::merge_views_voxel_hash({first, second}, poses, .001, 0), std::invalid_argument);
+}
+
+/**
+ * Integral image normals of a tilted plane should all match the plane normal, also next to a hole and at the
+ * borders, and be NaN at the hole.
+ */
+TEST_F(AlgosFixture, TestIntegralNormalsTiltedPlane) {
+    pcl::PointCloud<pcl::PointXYZ> grid;
+    grid.width = 80;
+    grid.height = 60;
+    Eigen::Vector3f expected = Eigen::Vector3f(.2, -.5, 1).normalized();
+    for (int v = 0; v < 60; v++) {
+        for (int u = 0; u < 80; u++) {
+            float x = -.04f + .001f * u;
+            float y = -.03f + .001f * v;
+            grid.points.push_back(pcl::PointXYZ(x, y, .4f - (.2f * x - .5f * y)));
+        }
+    }
+    grid.points[30 * 80 + 40] = pcl::PointXYZ(std::nanf(""), std::nanf(""), std::nanf(""));
+
+    pcl::PointCloud<pcl::Normal> normals = algos::estimate_integral_normals(grid, 3);
+    ASSERT_EQ(normals.size(), grid.size());
+    ASSERT_TRUE(std::isnan(normals.points[30 * 80 + 40].normal_x));
+    for (int i : {0, 81, 30 * 80 + 41, 59 * 80 + 79}) {
+        Eigen::Vector3f n = normals.points[i].getNormalVector3fMap();
+        ASSERT_NEAR(std::abs(n.dot(expected)), 1, 1e-4);
+    }
+}
+
+/**
+ * Plane queries over several clouds: signed distances, the closest inlier and the inlier centroid.
+ */
+TEST_F(AlgosFixture, TestQueryPlanePoints) {
+    auto first = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    first->push_back(pcl::PointXYZ(0, 0, .5));
+    first->push_back(pcl::PointXYZ(1, 0, .002));
+    first->push_back(pcl::PointXYZ(std::nanf(""), 0, 0));
+    auto second = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    second->push_back(pcl::PointXYZ(-1, 2, -.001));
+    second->push_back(pcl::PointXYZ(3, 3, -.004));
+
+    // z = 0 with a normal that isn't unit length
+    equations::Plane plane(0, 0, 2, 0);
+    std::vector<float> distances;
+    // garbage in the padding float must not leak into the distance
+    first->points[1].data[3] = std::nanf("");
+    algos::plane_signed_distances(*first, plane, distances);
+    ASSERT_EQ(distances.size(), 3);
+    ASSERT_FLOAT_EQ(distances[0], .5);
+    ASSERT_FLOAT_EQ(distances[1], .002);
+    ASSERT_TRUE(std::isnan(distances[2]));
+
+    algos::PlanePointQuery query = algos::query_plane_points({first, second}, plane, .003);
+    ASSERT_TRUE(query.found);
+    ASSERT_EQ(query.inliers, 2);
+    ASSERT_FLOAT_EQ(query.best_inlier.x, -1);
+    ASSERT_NEAR(query.best_distance, -.001, 1e-7);
+    ASSERT_NEAR(query.least_squares_point.x, 0, 1e-7);
+    ASSERT_NEAR(query.least_squares_point.z, .0005, 1e-7);
+    ASSERT_NEAR(query.mean_distance, .0005, 1e-7);
+    ASSERT_NEAR(query.max_abs_distance, .002, 1e-7);
+
+    ASSERT_FALSE(algos::query_plane_points({first}, plane, 1e-4).found);
+}
+
+/**
+ * Turntable removal with a tilted axis: keeps points above the surface and inside the bed, NaNs the rest and
+ * keeps the grid.
+ */
+TEST_F(AlgosFixture, TestRemoveTurntable) {
+    Eigen::Vector3f origin(.01, .02, .4);
+    Eigen::Vector3f axis = Eigen::Vector3f(0, -.8, -.6).normalized();
+    Eigen::Vector3f side = axis.unitOrthogonal();
+    pcl::PointCloud<pcl::PointXYZ> cloud;
+    cloud.width = 3;
+    cloud.height = 2;
+    auto at = [&](float height, float radial) {
+        Eigen::Vector3f p = origin + height * axis + radial * side;
+        return pcl::PointXYZ(p[0], p[1], p[2]);
+    };
+    cloud.points = {at(.05, .02),    // object
+                    at(.001, .02),   // turntable surface
+                    at(-.01, .02),   // under the turntable
+                    at(.05, .1),     // outside the bed
+                    at(.25, 0),      // above max height
+                    pcl::PointXYZ(std::nanf(""), 0, 0)};
+
+    std::size_t removed = algos::remove_turntable(cloud, origin, axis, .18, .002, .2);
+
+    ASSERT_EQ(removed, 4);
+    ASSERT_EQ(cloud.height, 2);
+    ASSERT_TRUE(std::isfinite(cloud.points[0].x));
+    for (int i = 1; i < 6; i++) {
+        ASSERT_TRUE(std::isnan(cloud.points[i].x));
+    }
+    ASSERT_FALSE(cloud.is_dense);
+}
@@ -0,0 +1,32 @@
+#include "gtest/gtest.h"
+#include "DepthBackground.h"
+
+/**
+ * Median fusion should ignore a flickering frame and missing samples, and pixels seen too rarely stay empty.
+ */
+TEST(DepthBackgroundTests, TestFuseDepthFrames) {
+    std::vector<std::vector<uint16_t>> frames = {{1000, 0, 500},
+                                                 {1002, 0, 0},
+                                                 {4000, 700, 0},
+                                                 {1001, 0, 0}};
+    std::vector<uint16_t> fused = algos::fuse_depth_frames(frames, 2);
+
+    ASSERT_EQ(fused.size(), 3);
+    ASSERT_EQ(fused[0], 1002);
+    ASSERT_EQ(fused[1], 0);
+    ASSERT_EQ(fused[2], 0);
+    ASSERT_THROW(algos::fuse_depth_frames({{1, 2}, {1}}), std::invalid_argument);
+}
+
+/**
+ * Only pixels at least margin in front of the background survive, pixels without background are kept.
+ */
+TEST(DepthBackgroundTests, TestSubtractDepthBackground) {
+    std::vector<uint16_t> background = {1000, 1000, 1000, 1000, 0};
+    std::vector<uint16_t> depth = {800, 995, 1000, 1200, 900};
+
+    std::size_t cleared = algos::subtract_depth_background(depth, background, 10);
+
+    ASSERT_EQ(cleared, 3);
+    ASSERT_EQ(depth, std::vector<uint16_t>({800, 0, 0, 0, 900}));
+}
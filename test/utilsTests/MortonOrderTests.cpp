@@ -0,0 +1,71 @@
+#include "gtest/gtest.h"
+#include "MortonOrder.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+
+/**
+ * Radix sort should match a stable sort of the same keys, across many chunks and with duplicates, and report
+ * where every key came from.
+ */
+TEST(MortonOrderTests, TestRadixSortKeys) {
+    std::mt19937_64 rng(7);
+    std::vector<uint64_t> keys(200000);
+    for (auto &k : keys) {
+        // duplicates and a byte that never changes
+        k = (rng() % 5000) << 16 | 0xab00;
+    }
+    std::vector<uint64_t> expected = keys;
+    std::vector<uint32_t> expected_order(keys.size());
+    std::iota(expected_order.begin(), expected_order.end(), 0);
+    std::stable_sort(expected_order.begin(), expected_order.end(),
+                     [&keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+    std::sort(expected.begin(), expected.end());
+
+    std::vector<uint32_t> order;
+    algos::radix_sort_keys(keys, order);
+    ASSERT_EQ(keys, expected);
+    ASSERT_EQ(order, expected_order);
+}
+
+/**
+ * Sorting should drop NaN points, and the octree should answer box queries like a brute force scan and give
+ * one point per occupied node for level of detail.
+ */
+TEST(MortonOrderTests, TestMortonOctree) {
+    uint32_t x, y, z;
+    algos::morton_decode(algos::morton_encode(1234567, 5, 2097151), x, y, z);
+    ASSERT_EQ(x, 1234567);
+    ASSERT_EQ(y, 5);
+    ASSERT_EQ(z, 2097151);
+
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> coord(-.1, .1);
+    auto cloud = std::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    for (int i = 0; i < 20000; i++) {
+        cloud->push_back(pcl::PointXYZ(coord(rng), coord(rng), coord(rng)));
+    }
+    cloud->push_back(pcl::PointXYZ(std::nanf(""), 0, 0));
+    algos::MortonOctree octree(cloud);
+    ASSERT_EQ(cloud->size(), 20000);
+    ASSERT_TRUE(std::is_sorted(octree.get_codes().begin(), octree.get_codes().end()));
+
+    Eigen::Vector3f min(-.03, 0, -.1), max(.05, .02, .01);
+    std::vector<int> expected;
+    for (int i = 0; i < int(cloud->size()); i++) {
+        Eigen::Vector3f p = cloud->points[i].getVector3fMap();
+        if ((p.array() >= min.array()).all() && (p.array() <= max.array()).all()) {
+            expected.push_back(i);
+        }
+    }
+    ASSERT_FALSE(expected.empty());
+    ASSERT_EQ(octree.box_query(min, max), expected);
+
+    ASSERT_EQ(octree.lod_indices(0).size(), 1);
+    ASSERT_EQ(octree.lod_indices(1).size(), 8);
+    auto root = octree.node_range(0, 0);
+    ASSERT_EQ(root.second - root.first, cloud->size());
+    int level = octree.level_for_size(.05);
+    ASSERT_GE(octree.get_grid().cell_size * float(1 << (algos::MORTON_BITS - level)), .05);
+}
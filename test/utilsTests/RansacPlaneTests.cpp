@@ -0,0 +1,104 @@
+#include "gtest/gtest.h"
+#include "RansacPlane.h"
+#include <pcl/point_types.h>
+#include <random>
+
+class RansacPlaneFixture : public ::testing::Test {
+
+protected:
+    pcl::PointCloud<pcl::PointXYZ> scene;
+    pcl::PointCloud<pcl::Normal> normals;
+
+    virtual void SetUp() {
+        // calibration like scene: a big ground plane, a smaller upright plane and some clutter
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<float> coord(-.1, .1);
+        std::normal_distribution<float> noise(0, .0005);
+        for (int i = 0; i < 20000; i++) {
+            add(pcl::PointXYZ(coord(rng), coord(rng), noise(rng)), 0, 0, 1);
+        }
+        for (int i = 0; i < 8000; i++) {
+            add(pcl::PointXYZ(.05f + noise(rng), coord(rng), .1f + coord(rng) / 2), 1, 0, 0);
+        }
+        for (int i = 0; i < 3000; i++) {
+            add(pcl::PointXYZ(coord(rng), coord(rng), .1f + coord(rng)), 0, 1, 0);
+        }
+    }
+
+    void add(const pcl::PointXYZ &p, float nx, float ny, float nz) {
+        scene.push_back(p);
+        normals.push_back(pcl::Normal(nx, ny, nz));
+    }
+};
+
+/**
+ * With the axis constraint RANSAC should lock onto the ground and stop long before max_iterations.
+ * The same seed has to give the same plane.
+ */
+TEST_F(RansacPlaneFixture, TestGroundPlaneWithAxis) {
+    algos::PlaneFitParams params;
+    params.distance_threshold = .003;
+    params.axis = Eigen::Vector3f(.1, .1, 1);
+    params.eps_angle = .5;
+    algos::PlaneFitResult ground = algos::fit_plane_ransac(scene, nullptr, nullptr, params);
+
+    ASSERT_TRUE(ground.found);
+    ASSERT_GT(ground.coefficients[2], .999);
+    ASSERT_NEAR(ground.coefficients[3], 0, 1e-3);
+    ASSERT_GE(ground.inliers.size(), 19900);
+    ASSERT_LT(ground.iterations, 200);
+    ASSERT_LE(ground.full_scores, ground.iterations);
+
+    algos::PlaneFitResult again = algos::fit_plane_ransac(scene, nullptr, nullptr, params);
+    ASSERT_EQ(again.coefficients, ground.coefficients);
+    ASSERT_EQ(again.inliers, ground.inliers);
+}
+
+/**
+ * Leaving the ground out through the indices and weighting normals should find the upright plane.
+ */
+TEST_F(RansacPlaneFixture, TestUprightPlaneWithNormals) {
+    std::vector<int> rest;
+    for (int i = 20000; i < int(scene.size()); i++) {
+        rest.push_back(i);
+    }
+    algos::PlaneFitParams params;
+    params.distance_threshold = .003;
+    params.normal_distance_weight = .02;
+    algos::PlaneFitResult upright = algos::fit_plane_ransac(scene, &normals, &rest, params);
+
+    ASSERT_TRUE(upright.found);
+    ASSERT_GT(std::abs(upright.coefficients[0]), .999);
+    ASSERT_NEAR(std::abs(upright.coefficients[3]), .05, 1e-3);
+    ASSERT_GE(upright.inliers.size(), 7900);
+    for (int i : upright.inliers) {
+        ASSERT_GE(i, 20000);
+    }
+}
+
+/**
+ * Ground then upright on one gathered buffer, the second fit only masks out the ground inliers.
+ */
+TEST_F(RansacPlaneFixture, TestMaskedFitsShareData) {
+    const algos::PlaneFitData data = algos::PlaneFitData::gather(scene, &normals, nullptr);
+    ASSERT_EQ(data.size(), scene.size());
+
+    algos::PlaneFitParams ground_params;
+    ground_params.distance_threshold = .003;
+    ground_params.normal_distance_weight = .02;
+    ground_params.axis = Eigen::Vector3f(0, 0, 1);
+    ground_params.eps_angle = .5;
+    algos::PlaneFitResult ground = algos::fit_plane_ransac(data, nullptr, ground_params);
+    ASSERT_TRUE(ground.found);
+    ASSERT_EQ(std::size_t(ground.inlier_mask.count()), ground.inliers.size());
+
+    algos::PlaneMask not_ground = !ground.inlier_mask;
+    algos::PlaneFitParams up_params;
+    up_params.distance_threshold = .003;
+    up_params.normal_distance_weight = .02;
+    algos::PlaneFitResult upright = algos::fit_plane_ransac(data, &not_ground, up_params);
+
+    ASSERT_TRUE(upright.found);
+    ASSERT_GT(std::abs(upright.coefficients[0]), .999);
+    ASSERT_FALSE((upright.inlier_mask && ground.inlier_mask).any());
+}
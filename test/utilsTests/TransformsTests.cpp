@@ -0,0 +1,100 @@
+#include "gtest/gtest.h"
+#include "Transforms.h"
+#include "Algorithms.h"
+#include <pcl/point_types.h>
+#include <cmath>
+
+/**
+ * The line rotation matrix should move points exactly like the per point formula.
+ */
+TEST(TransformsTests, TestRotationAboutLineMatchesPointFormula) {
+    std::vector<float> line_point = {.1, -.2, .3};
+    Eigen::Vector3f direction = Eigen::Vector3f(1, 2, -.5).normalized();
+    std::vector<float> line_direction = {direction[0], direction[1], direction[2]};
+    float theta = .7;
+    Eigen::Matrix4f rotation = transforms::rotation_about_line(Eigen::Vector3f(.1, -.2, .3), direction, theta);
+
+    for (int i = 0; i < 10; i++) {
+        pcl::PointXYZ p(.05f * i, -.03f * i + .1f, .2f);
+        pcl::PointXYZ expected = algos::rotate_point_about_line(p, line_point, line_direction, theta);
+        pcl::PointXYZ actual;
+        transforms::transform_point(rotation, p, actual);
+        EXPECT_NEAR(actual.x, expected.x, 1e-5);
+        EXPECT_NEAR(actual.y, expected.y, 1e-5);
+        EXPECT_NEAR(actual.z, expected.z, 1e-5);
+    }
+}
+
+/**
+ * Transforming in place should match transforming into another cloud, and NaN points should keep their place
+ * in the organized grid.
+ */
+TEST(TransformsTests, TestTransformCloudInPlace) {
+    pcl::PointCloud<pcl::PointXYZ> cloud;
+    cloud.width = 4;
+    cloud.height = 2;
+    for (int i = 0; i < 8; i++) {
+        cloud.points.push_back(pcl::PointXYZ(.01f * i, .02f, .4f - .01f * i));
+    }
+    cloud.points[3] = pcl::PointXYZ(NAN, NAN, NAN);
+    cloud.is_dense = false;
+
+    Eigen::Matrix4f world = transforms::rotation_about_line(Eigen::Vector3f(0, .03, .4), Eigen::Vector3f::UnitX(),
+                                                            -1.0f);
+    Eigen::Matrix4f transform = algos::z_rotation_matrix(40) * world;
+    pcl::PointCloud<pcl::PointXYZ> copied;
+    transforms::transform_cloud(cloud, copied, transform);
+    transforms::transform_cloud(cloud, transform);
+
+    ASSERT_EQ(cloud.width, 4);
+    ASSERT_EQ(cloud.height, 2);
+    EXPECT_TRUE(std::isnan(cloud.points[3].x));
+    for (int i = 0; i < 8; i++) {
+        if (i == 3) {
+            continue;
+        }
+        EXPECT_NEAR(cloud.points[i].x, copied.points[i].x, 1e-6);
+        EXPECT_NEAR(cloud.points[i].y, copied.points[i].y, 1e-6);
+        EXPECT_NEAR(cloud.points[i].z, copied.points[i].z, 1e-6);
+    }
+}
+
+/**
+ * The fused crop should keep exactly the points whose transformed position is inside the cylinder, as NaN
+ * holes in the grid or compacted in order.
+ */
+TEST(TransformsTests, TestTransformCloudCropped) {
+    Eigen::Matrix4f world = transforms::rotation_about_line(Eigen::Vector3f(.01, .02, .4),
+                                                            Eigen::Vector3f(1, 0, 0), -2.1f);
+    world.topRightCorner<3, 1>() += Eigen::Vector3f(-.01, .03, -.2);
+    Eigen::Matrix4f to_camera = world.inverse();
+    auto camera_point = [&](float x, float y, float z) {
+        pcl::PointXYZ p;
+        transforms::transform_point(to_camera, pcl::PointXYZ(x, y, z), p);
+        return p;
+    };
+    pcl::PointCloud<pcl::PointXYZ> cloud;
+    cloud.width = 3;
+    cloud.height = 2;
+    cloud.points = {camera_point(.02, -.03, .05),   // inside
+                    camera_point(.1, 0, .05),       // outside the radius
+                    camera_point(0, 0, -.01),       // under the turntable
+                    camera_point(0, .05, .29),      // inside, near the top
+                    camera_point(0, 0, .31),        // above
+                    pcl::PointXYZ(std::nanf(""), 0, 0)};
+    transforms::CylinderCrop crop{.09, 0, .3};
+
+    pcl::PointCloud<pcl::PointXYZ> organized;
+    ASSERT_EQ(transforms::transform_cloud_cropped(cloud, organized, world, crop), 2);
+    ASSERT_EQ(organized.height, 2);
+    ASSERT_NEAR(organized.points[0].x, .02, 1e-5);
+    ASSERT_NEAR(organized.points[3].z, .29, 1e-5);
+    for (int i : {1, 2, 4, 5}) {
+        ASSERT_TRUE(std::isnan(organized.points[i].x));
+    }
+
+    ASSERT_EQ(transforms::transform_cloud_cropped(cloud, cloud, world, crop, false), 2);
+    ASSERT_EQ(cloud.size(), 2);
+    ASSERT_NEAR(cloud.points[0].y, -.03, 1e-5);
+    ASSERT_NEAR(cloud.points[1].y, .05, 1e-5);
+}